@@ -0,0 +1,260 @@
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include "Log.h"
+#include "Manifold.h"
+#include "MeshProjector.h"
+#include "Parallel.h"
+#include "Progress.h"
+#include "ResultCache.h"
+#include "types.h"
+
+namespace py = pybind11;
+
+// Hands a heap matrix to NumPy without copying; the capsule deletes the
+// matrix when the array is collected.
+template <class Matrix>
+static py::array ToNumpy(std::unique_ptr<Matrix> matrix)
+{
+	typedef typename Matrix::Scalar Scalar;
+	Matrix* m = matrix.release();
+	py::capsule owner(m, [](void* p) {
+		delete reinterpret_cast<Matrix*>(p);
+	});
+	py::ssize_t rows = m->rows(), cols = m->cols();
+	py::ssize_t item = sizeof(Scalar);
+	return py::array_t<Scalar>({rows, cols}, {item * cols, item},
+		m->data(), owner);
+}
+
+// Forwards progress to an optional Python callable(stage, fraction); a
+// return value of False cancels the job. The GIL is only held for the call.
+static void WatchProgress(Progress* progress, py::object callback)
+{
+	if (callback.is_none())
+		return;
+	progress->SetCallback([progress, callback](const char* stage,
+		double fraction) {
+		py::gil_scoped_acquire acquire;
+		py::object keep_going = callback(stage, fraction);
+		if (!keep_going.is_none() && !keep_going.cast<bool>())
+			progress->Cancel();
+	});
+}
+
+// Raises the Python error matching why a job returned no output.
+static void CheckStatus(ManifoldStatus status)
+{
+	if (status == MANIFOLD_CANCELLED)
+		throw std::runtime_error("cancelled by the progress callback");
+	if (status == MANIFOLD_FAILED)
+		throw std::runtime_error("manifold construction failed");
+	if (status == MANIFOLD_OVER_BUDGET) {
+		PyErr_SetString(PyExc_MemoryError,
+			"the job does not fit memory_budget at any depth");
+		throw py::error_already_set();
+	}
+}
+
+// V and F bind without a copy when they are C-contiguous float64 / int32
+// arrays; other layouts are converted once by pybind11.
+static py::tuple Process(MatrixDRef V, MatrixIRef F, int depth,
+	int coarse_levels, const ProjectorOptions& options, double memory_budget,
+	bool lower_depth, py::object progress_callback,
+	const std::string& cache_dir, double cache_size)
+{
+	if (depth < 1 || depth > GRID_MAX_DEPTH)
+		throw py::value_error("depth must be between 1 and "
+			+ std::to_string(GRID_MAX_DEPTH));
+	std::unique_ptr<MatrixD> out_V(new MatrixD());
+	std::unique_ptr<MatrixI> out_F(new MatrixI());
+	Progress progress;
+	WatchProgress(&progress, progress_callback);
+	ManifoldStatus status = MANIFOLD_OK;
+	{
+		py::gil_scoped_release release;
+		Manifold manifold;
+		manifold.SetProjectorOptions(options);
+		manifold.SetMemoryBudget(memory_budget, lower_depth);
+		manifold.SetProgress(&progress);
+		std::unique_ptr<ResultCache> cache;
+		if (!cache_dir.empty()) {
+			cache.reset(new ResultCache(cache_dir, cache_size));
+			manifold.SetCache(cache.get());
+		}
+		if (coarse_levels > 0) {
+			depth = manifold.ProcessManifoldMultiResolution(V, F, depth,
+				coarse_levels, out_V.get(), out_F.get());
+		} else {
+			depth = manifold.ProcessManifold(V, F, depth, out_V.get(),
+				out_F.get());
+		}
+		status = manifold.Status();
+	}
+	CheckStatus(status);
+	return py::make_tuple(ToNumpy(std::move(out_V)), ToNumpy(std::move(out_F)));
+}
+
+static py::tuple ProcessProgressive(MatrixDRef V, MatrixIRef F,
+	const ProgressiveOptions& progressive, const ProjectorOptions& options,
+	py::object progress_callback, const std::string& cache_dir,
+	double cache_size)
+{
+	if (progressive.max_depth < 1 || progressive.max_depth > GRID_MAX_DEPTH)
+		throw py::value_error("max_depth must be between 1 and "
+			+ std::to_string(GRID_MAX_DEPTH));
+	if (progressive.min_depth < 1
+		|| progressive.min_depth > progressive.max_depth)
+		throw py::value_error("min_depth must be between 1 and max_depth");
+	std::unique_ptr<MatrixD> out_V(new MatrixD());
+	std::unique_ptr<MatrixI> out_F(new MatrixI());
+	int depth = 0;
+	Progress progress;
+	WatchProgress(&progress, progress_callback);
+	ManifoldStatus status = MANIFOLD_OK;
+	{
+		py::gil_scoped_release release;
+		Manifold manifold;
+		manifold.SetProjectorOptions(options);
+		manifold.SetProgress(&progress);
+		std::unique_ptr<ResultCache> cache;
+		if (!cache_dir.empty()) {
+			cache.reset(new ResultCache(cache_dir, cache_size));
+			manifold.SetCache(cache.get());
+		}
+		depth = manifold.ProcessManifoldProgressive(V, F, progressive,
+			out_V.get(), out_F.get());
+		status = manifold.Status();
+	}
+	CheckStatus(status);
+	return py::make_tuple(ToNumpy(std::move(out_V)), ToNumpy(std::move(out_F)),
+		depth);
+}
+
+// One Manifold kept between calls, so that every call after the first only
+// rebuilds the output near the faces it is told have changed.
+struct IncrementalSession
+{
+	IncrementalSession(int depth, const ProjectorOptions& options)
+	: depth(depth)
+	{
+		manifold.SetProjectorOptions(options);
+	}
+	int depth;
+	Manifold manifold;
+	// calls from several Python threads take turns
+	std::mutex mutex;
+};
+
+static py::tuple ProcessIncremental(IncrementalSession& session,
+	MatrixDRef V, MatrixIRef F, const std::vector<int>& changed_faces,
+	py::object progress_callback)
+{
+	std::unique_ptr<MatrixD> out_V(new MatrixD());
+	std::unique_ptr<MatrixI> out_F(new MatrixI());
+	Progress progress;
+	WatchProgress(&progress, progress_callback);
+	ManifoldStatus status = MANIFOLD_OK;
+	{
+		py::gil_scoped_release release;
+		std::lock_guard<std::mutex> lock(session.mutex);
+		session.manifold.SetProgress(&progress);
+		session.manifold.ProcessManifoldIncremental(V, F, session.depth,
+			changed_faces, out_V.get(), out_F.get());
+		session.manifold.SetProgress(0);
+		status = session.manifold.Status();
+	}
+	CheckStatus(status);
+	return py::make_tuple(ToNumpy(std::move(out_V)), ToNumpy(std::move(out_F)));
+}
+
+PYBIND11_MODULE(manifoldplus, m)
+{
+	m.doc() = "Watertight manifold conversion of triangle soups";
+	// a library stays quiet unless asked; set_log_level(2) restores the
+	// command line's progress messages
+	SetLogLevel(LOG_WARNING);
+	m.def("set_log_level", [](int level) {
+		if (level < LOG_ERROR || level > LOG_DEBUG)
+			throw py::value_error("log level must be between 0 and 3");
+		SetLogLevel((LogLevel)level);
+	}, "0 error, 1 warning (the default), 2 info, 3 debug.",
+		py::arg("level"));
+	m.def("set_num_threads", [](int threads, bool pin_threads,
+		int first_cpu) {
+		if (first_cpu < 0)
+			throw py::value_error("first_cpu must not be negative");
+		py::gil_scoped_release release;
+		SetNumThreads(threads, pin_threads, first_cpu);
+	}, "Threads used by every job, counting the caller; 0 (the default) is "
+		"one per hardware thread. pin_threads binds the workers to the CPUs "
+		"the process may run on, starting after the first_cpu-th. Must not "
+		"be called while a job runs.",
+		py::arg("threads"), py::arg("pin_threads") = false,
+		py::arg("first_cpu") = 0);
+	m.def("num_threads", &NumThreads);
+
+	py::class_<ProjectorOptions>(m, "ProjectorOptions")
+		.def(py::init<>())
+		.def_readwrite("ring_cache", &ProjectorOptions::ring_cache)
+		.def_readwrite("reorder", &ProjectorOptions::reorder)
+		.def_readwrite("stable_order", &ProjectorOptions::stable_order)
+		.def_readwrite("max_seconds", &ProjectorOptions::max_seconds)
+		.def_readwrite("max_iterations", &ProjectorOptions::max_iterations)
+		.def_readwrite("max_visit_ratio", &ProjectorOptions::max_visit_ratio)
+		.def_readwrite("target_max_distance",
+			&ProjectorOptions::target_max_distance)
+		.def_readwrite("target_mean_distance",
+			&ProjectorOptions::target_mean_distance)
+		.def_readwrite("min_improvement", &ProjectorOptions::min_improvement)
+		.def_readwrite("trace", &ProjectorOptions::trace)
+		.def_readwrite("seed", &ProjectorOptions::seed);
+
+	py::class_<ProgressiveOptions>(m, "ProgressiveOptions")
+		.def(py::init<>())
+		.def_readwrite("min_depth", &ProgressiveOptions::min_depth)
+		.def_readwrite("max_depth", &ProgressiveOptions::max_depth)
+		.def_readwrite("target_error", &ProgressiveOptions::target_error)
+		.def_readwrite("min_improvement", &ProgressiveOptions::min_improvement)
+		.def_readwrite("max_seconds", &ProgressiveOptions::max_seconds)
+		.def_readwrite("max_memory_mb", &ProgressiveOptions::max_memory_mb);
+
+	m.def("process", &Process,
+		"Returns the (V, F) of a watertight manifold approximating V, F.",
+		py::arg("V"), py::arg("F"), py::arg("depth") = 8,
+		py::arg("coarse_levels") = 0,
+		py::arg("options") = ProjectorOptions(),
+		py::arg("memory_budget") = 0.0, py::arg("lower_depth") = true,
+		py::arg("progress") = py::none(), py::arg("cache_dir") = "",
+		py::arg("cache_size") = 1024.0);
+	m.def("process_progressive", &ProcessProgressive,
+		"Like process, but picks the depth; returns (V, F, depth).",
+		py::arg("V"), py::arg("F"),
+		py::arg("progressive") = ProgressiveOptions(),
+		py::arg("options") = ProjectorOptions(),
+		py::arg("progress") = py::none(), py::arg("cache_dir") = "",
+		py::arg("cache_size") = 1024.0);
+
+	py::class_<IncrementalSession>(m, "IncrementalSession")
+		.def(py::init([](int depth, const ProjectorOptions& options) {
+			if (depth < 1 || depth > GRID_MAX_DEPTH)
+				throw py::value_error("depth must be between 1 and "
+					+ std::to_string(GRID_MAX_DEPTH));
+			return new IncrementalSession(depth, options);
+		}), py::arg("depth") = 8, py::arg("options") = ProjectorOptions())
+		.def("process", &ProcessIncremental,
+			"Returns (V, F) for V, F; after the first call only the output "
+			"near changed_faces, indices of the faces that differ from the "
+			"previous call's input, is rebuilt.",
+			py::arg("V"), py::arg("F"),
+			py::arg("changed_faces") = std::vector<int>(),
+			py::arg("progress") = py::none());
+}
@@ -3,6 +3,9 @@
 
 #include "types.h"
 
+// Deepest octree whose doubled grid coordinates fit the packed key.
+#define GRID_MAX_DEPTH 18
+
 struct GridIndex
 {
 public:
@@ -10,12 +13,17 @@ public:
 	GridIndex(int x, int y, int z)
 	: id(x,y,z)
 	{}
+	// Lexicographic order, compared as one packed 64-bit key with 21
+	// biased bits per axis.
 	bool operator<(const GridIndex& ind) const
 	{
-		int i = 0;
-		while (i < 3 && id[i] == ind.id[i])
-			i++;
-		return (i < 3 && id[i] < ind.id[i]);
+		return Key() < ind.Key();
+	}
+	unsigned long long Key() const
+	{
+		const unsigned long long bias = 1 << 20;
+		return ((id[0] + bias) << 42) | ((id[1] + bias) << 21)
+			| (id[2] + bias);
 	}
 	GridIndex operator+(const GridIndex& ind) const
 	{
@@ -4,14 +4,15 @@
 #include <fstream>
 #include <vector>
 
-void ReadOBJ(const char* filename, MatrixD* V, MatrixI* F) {
+bool ReadOBJ(const char* filename, MatrixD* V, MatrixI* F) {
 	int len = strlen(filename);
-	if (strcmp(filename + (len - 3), "off") == 0) {
-		igl::readOFF(filename, *V, *F);
-		return;
+	if (len >= 3 && strcmp(filename + (len - 3), "off") == 0) {
+		return igl::readOFF(filename, *V, *F);
 	}
 	char buffer[1024];
 	std::ifstream is(filename);
+	if (!is)
+		return false;
 	std::vector<Vector3> vertices;
 	std::vector<Vector3i> faces;
 	while (is >> buffer) {
@@ -39,10 +40,15 @@ void ReadOBJ(const char* filename, MatrixD* V, MatrixI* F) {
 	F->resize(faces.size(), 3);
 	memcpy(V->data(), vertices.data(), sizeof(Vector3) * vertices.size());
 	memcpy(F->data(), faces.data(), sizeof(Vector3i) * faces.size());
+	return true;
 }
 
-void WriteOBJ(const char* filename, const MatrixD& V, const MatrixI& F) {
+bool WriteOBJ(const char* filename, const MatrixD& V, const MatrixI& F) {
 	std::ofstream os(filename);
+	if (!os)
+		return false;
+	// round-trip precision, so far-from-origin meshes keep their detail
+	os.precision(17);
 	for (int i = 0; i < V.rows(); ++i) {
 		auto& v = V.row(i);
 		os << "v " << v[0] << " " << v[1] << " " << v[2] << "\n";
@@ -52,10 +58,14 @@ void WriteOBJ(const char* filename, const MatrixD& V, const MatrixI& F) {
 		os << "f " << f[0] + 1 << " " << f[1] + 1 << " " << f[2] + 1 << "\n";
 	}
 	os.close();
+	return !os.fail();
 }
 
-void WriteOFF(const char* filename, const MatrixD& V, const MatrixI& F) {
+bool WriteOFF(const char* filename, const MatrixD& V, const MatrixI& F) {
     std::ofstream os(filename);
+    if (!os)
+        return false;
+    os.precision(17);
     
     // OFF file header
     os << "OFF\n";
@@ -74,4 +84,5 @@ void WriteOFF(const char* filename, const MatrixD& V, const MatrixI& F) {
     }
 
     os.close();
+    return !os.fail();
 }
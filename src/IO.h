@@ -3,10 +3,11 @@
 
 #include "types.h"
 
-void ReadOBJ(const char* filename, MatrixD* V, MatrixI* F);
-void WriteOBJ(const char* filename, const MatrixD& V, const MatrixI& F);
+// All return false when the file cannot be opened.
+bool ReadOBJ(const char* filename, MatrixD* V, MatrixI* F);
+bool WriteOBJ(const char* filename, const MatrixD& V, const MatrixI& F);
 
 // Added by Doncey A.
-void WriteOFF(const char* filename, const MatrixD& V, const MatrixI& F);
+bool WriteOFF(const char* filename, const MatrixD& V, const MatrixI& F);
 
 #endif
\ No newline at end of file
@@ -3,6 +3,10 @@
 #include <math.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include <Eigen/Dense>
 
 #define X 0
@@ -174,6 +178,163 @@ int TriBoxOverlap(float boxcenter[3],float boxhalfsize[3],float triverts[3][3])
    return 1;   /* box and triangle overlaps */
 }
 
+/*======================== Exact test ========================*/
+/*  Values are kept as nonoverlapping expansions (Shewchuk, "Adaptive */
+/*  Precision Floating-Point Arithmetic and Fast Robust Geometric */
+/*  Predicates"): sums of doubles in increasing magnitude whose sign is the */
+/*  sign of the last component. */
+
+typedef std::vector<double> Expansion;
+
+static void TwoSum(double a, double b, double* x, double* y)
+{
+  *x = a + b;
+  double bv = *x - a;
+  double av = *x - bv;
+  *y = (a - av) + (b - bv);
+}
+
+static Expansion ExpansionDiff(double a, double b)
+{
+  double x, y;
+  TwoSum(a, -b, &x, &y);
+  Expansion h;
+  if (y != 0) h.push_back(y);
+  if (x != 0) h.push_back(x);
+  return h;
+}
+
+static Expansion ExpansionAdd(const Expansion& e, const Expansion& f)
+{
+  Expansion h = e;
+  for (size_t i = 0; i < f.size(); ++i) {
+    /* grow_expansion_zeroelim */
+    Expansion g;
+    double q = f[i], hh;
+    for (size_t j = 0; j < h.size(); ++j) {
+      TwoSum(q, h[j], &q, &hh);
+      if (hh != 0) g.push_back(hh);
+    }
+    if (q != 0) g.push_back(q);
+    h.swap(g);
+  }
+  return h;
+}
+
+static Expansion ExpansionScale(const Expansion& e, double b)
+{
+  /* scale_expansion_zeroelim, with fma for the exact products */
+  Expansion h;
+  if (e.empty() || b == 0) return h;
+  double q = e[0] * b;
+  double hh = std::fma(e[0], b, -q);
+  if (hh != 0) h.push_back(hh);
+  for (size_t i = 1; i < e.size(); ++i) {
+    double p1 = e[i] * b;
+    double p0 = std::fma(e[i], b, -p1);
+    double sum;
+    TwoSum(q, p0, &sum, &hh);
+    if (hh != 0) h.push_back(hh);
+    TwoSum(p1, sum, &q, &hh);
+    if (hh != 0) h.push_back(hh);
+  }
+  if (q != 0) h.push_back(q);
+  return h;
+}
+
+static Expansion ExpansionMul(const Expansion& e, const Expansion& f)
+{
+  Expansion h;
+  for (size_t i = 0; i < f.size(); ++i)
+    h = ExpansionAdd(h, ExpansionScale(e, f[i]));
+  return h;
+}
+
+static Expansion ExpansionNeg(Expansion e)
+{
+  for (size_t i = 0; i < e.size(); ++i)
+    e[i] = -e[i];
+  return e;
+}
+
+static int ExpansionSign(const Expansion& e)
+{
+  if (e.empty()) return 0;
+  return e.back() > 0 ? 1 : -1;
+}
+
+/* sign of axis . (p - q) */
+static int ProjectionSign(const Expansion axis[3], const double p[3],
+  const double q[3])
+{
+  Expansion sum;
+  for (int i = 0; i < 3; ++i)
+    if (!axis[i].empty())
+      sum = ExpansionAdd(sum, ExpansionMul(axis[i], ExpansionDiff(p[i], q[i])));
+  return ExpansionSign(sum);
+}
+
+/* Separated iff the whole triangle projects strictly beyond the box on one */
+/* side; only the box corners extreme along the axis need to be checked. */
+static bool SeparatedAlong(const Expansion axis[3], const double boxmin[3],
+  const double boxmax[3], const double triverts[3][3])
+{
+  double cmax[3], cmin[3];
+  for (int i = 0; i < 3; ++i) {
+    bool positive = ExpansionSign(axis[i]) >= 0;
+    cmax[i] = positive ? boxmax[i] : boxmin[i];
+    cmin[i] = positive ? boxmin[i] : boxmax[i];
+  }
+  bool above = true, below = true;
+  for (int t = 0; t < 3 && (above || below); ++t) {
+    if (above && ProjectionSign(axis, triverts[t], cmax) <= 0) above = false;
+    if (below && ProjectionSign(axis, triverts[t], cmin) >= 0) below = false;
+  }
+  return above || below;
+}
+
+int TriBoxOverlapExact(const double boxmin[3], const double boxmax[3],
+  const double triverts[3][3])
+{
+  int i, j;
+  /* Bullet 1: box axes, exact on doubles */
+  for (i = 0; i < 3; ++i) {
+    double lo = triverts[0][i], hi = triverts[0][i];
+    for (j = 1; j < 3; ++j) {
+      lo = std::min(lo, triverts[j][i]);
+      hi = std::max(hi, triverts[j][i]);
+    }
+    if (lo > boxmax[i] || hi < boxmin[i]) return 0;
+  }
+
+  Expansion e[3][3];
+  for (i = 0; i < 3; ++i)
+    for (j = 0; j < 3; ++j)
+      e[i][j] = ExpansionDiff(triverts[(i + 1) % 3][j], triverts[i][j]);
+
+  /* Bullet 3: edge x {x,y,z}; edge x u_k has components */
+  /* (e_y u_z - e_z u_y, e_z u_x - e_x u_z, e_x u_y - e_y u_x) */
+  for (i = 0; i < 3; ++i) {
+    for (int k = 0; k < 3; ++k) {
+      Expansion axis[3];
+      axis[(k + 1) % 3] = e[i][(k + 2) % 3];
+      axis[(k + 2) % 3] = ExpansionNeg(e[i][(k + 1) % 3]);
+      if (SeparatedAlong(axis, boxmin, boxmax, triverts)) return 0;
+    }
+  }
+
+  /* Bullet 2: triangle normal */
+  Expansion normal[3];
+  for (i = 0; i < 3; ++i) {
+    int a = (i + 1) % 3, b = (i + 2) % 3;
+    normal[i] = ExpansionAdd(ExpansionMul(e[0][a], e[1][b]),
+      ExpansionNeg(ExpansionMul(e[0][b], e[1][a])));
+  }
+  if (SeparatedAlong(normal, boxmin, boxmax, triverts)) return 0;
+
+  return 1;
+}
+
 int PlaneIntersect(const Vector3& p0, const Vector3& n0,
   const Vector3& p1, const Vector3& n1,
   Vector3* o, Vector3* t) {
@@ -3,6 +3,11 @@
 
 #include "types.h"
 int TriBoxOverlap(float boxcenter[3],float boxhalfsize[3],float triverts[3][3]);
+// Exact version of TriBoxOverlap for the closed box [boxmin, boxmax]: the
+// separating axis tests are evaluated with floating-point expansions, so
+// no rounding can flip the answer. Much slower than the float test.
+int TriBoxOverlapExact(const double boxmin[3], const double boxmax[3],
+  const double triverts[3][3]);
 
 int PlaneIntersect(const Vector3& p0, const Vector3& n0,
   const Vector3& p1, const Vector3& n1,
@@ -0,0 +1,64 @@
+#include "Log.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+static void PrintLine(LogLevel level, const char* message)
+{
+	FILE* stream = (level == LOG_ERROR) ? stderr : stdout;
+	fprintf(stream, "%s\n", message);
+	fflush(stream);
+}
+
+static std::atomic<int> g_level(LOG_INFO);
+static std::mutex g_sink_mutex;
+static LogSink g_sink = PrintLine;
+
+void SetLogLevel(LogLevel level)
+{
+	g_level.store(level);
+}
+
+LogLevel GetLogLevel()
+{
+	return (LogLevel)g_level.load();
+}
+
+void SetLogSink(const LogSink& sink)
+{
+	std::lock_guard<std::mutex> lock(g_sink_mutex);
+	g_sink = sink;
+}
+
+bool LogEnabled(LogLevel level)
+{
+	return level <= g_level.load();
+}
+
+void Logf(LogLevel level, const char* format, ...)
+{
+	if (!LogEnabled(level))
+		return;
+	char buffer[512];
+	std::vector<char> large;
+	char* message = buffer;
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (length < 0)
+		return;
+	if (length >= (int)sizeof(buffer)) {
+		large.resize(length + 1);
+		va_start(args, format);
+		vsnprintf(large.data(), large.size(), format, args);
+		va_end(args);
+		message = large.data();
+	}
+	std::lock_guard<std::mutex> lock(g_sink_mutex);
+	if (g_sink)
+		g_sink(level, message);
+}
@@ -0,0 +1,40 @@
+#ifndef MANIFOLD2_LOG_H_
+#define MANIFOLD2_LOG_H_
+
+#include <functional>
+
+// Severity of a log message; a message is emitted when its level is at
+// most the current one.
+enum LogLevel {
+	LOG_ERROR = 0,
+	LOG_WARNING = 1,
+	LOG_INFO = 2,
+	LOG_DEBUG = 3
+};
+
+// Receives one complete message, without a trailing newline. Calls are
+// serialized, so messages from concurrent jobs never interleave.
+typedef std::function<void(LogLevel level, const char* message)> LogSink;
+
+// Process-wide; the defaults are LOG_INFO and a sink that prints each
+// message as a line on stdout. An empty sink discards everything.
+void SetLogLevel(LogLevel level);
+LogLevel GetLogLevel();
+void SetLogSink(const LogSink& sink);
+bool LogEnabled(LogLevel level);
+
+void Logf(LogLevel level, const char* format, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 2, 3)))
+#endif
+	;
+
+// Messages inside hot loops; compiled out unless built with LOG_OUTPUT
+// (-DBUILD_LOG=ON), so the loops never format strings or touch stdio.
+#ifdef LOG_OUTPUT
+#define LOG_VERBOSE(...) Logf(LOG_DEBUG, __VA_ARGS__)
+#else
+#define LOG_VERBOSE(...) do {} while (0)
+#endif
+
+#endif
@@ -1,11 +1,29 @@
 #include "Manifold.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+
 #include <Eigen/Dense>
 
+#include "Log.h"
 #include "MeshProjector.h"
+#include "Parallel.h"
+
+static long long EdgeKey(int x, int y)
+{
+	if (x > y)
+		std::swap(x, y);
+	return ((long long)x << 32) | y;
+}
 
 Manifold::Manifold()
-	: tree_(0)
+	: tree_(0), exterior_method_(EXTERIOR_BITMAP), max_memory_mb_(0),
+	  lower_depth_(true), progress_(0), status_(MANIFOLD_OK), cache_(0),
+	  scale_(1)
 {
 }
 
@@ -16,60 +34,996 @@ Manifold::~Manifold()
 	tree_ = 0;
 }
 
-void Manifold::ProcessManifold(const MatrixD& V, const MatrixI& F,
+void Manifold::SetProjectorOptions(const ProjectorOptions& options)
+{
+	projector_options_ = options;
+}
+
+void Manifold::SetExteriorMethod(ExteriorMethod method)
+{
+	exterior_method_ = method;
+}
+
+void Manifold::SetMemoryBudget(double max_memory_mb, bool lower_depth)
+{
+	max_memory_mb_ = max_memory_mb;
+	lower_depth_ = lower_depth;
+}
+
+void Manifold::SetProgress(Progress* progress)
+{
+	progress_ = progress;
+}
+
+void Manifold::SetCache(ResultCache* cache)
+{
+	cache_ = cache;
+}
+
+std::string Manifold::CacheParameters(const char* job) const
+{
+	// thread count and trace are left out: they never change the output
+	const ProjectorOptions& o = projector_options_;
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer), "%s|exterior %d|memory %.17g %d|"
+		"projector %d %d %d %.17g %d %.17g %.17g %.17g %.17g %u",
+		job, (int)exterior_method_, max_memory_mb_, (int)lower_depth_,
+		(int)o.ring_cache, (int)o.reorder, (int)o.stable_order, o.max_seconds,
+		o.max_iterations, o.max_visit_ratio, o.target_max_distance,
+		o.target_mean_distance, o.min_improvement, o.seed);
+	return buffer;
+}
+
+bool Manifold::LoadCached(const char* job, const MatrixDRef& V,
+	const MatrixIRef& F, CacheKey* key, MatrixD* out_V, MatrixI* out_F,
+	int* depth)
+{
+	if (!cache_)
+		return false;
+	*key = ResultCache::Key(V, F, CacheParameters(job));
+	if (!cache_->Load(*key, out_V, out_F, depth)) {
+		Logf(LOG_INFO, "Cache miss %s", key->Hex().c_str());
+		return false;
+	}
+	Logf(LOG_INFO, "Cache hit %s", key->Hex().c_str());
+	return true;
+}
+
+void Manifold::StoreCached(const CacheKey& key, const MatrixD& out_V,
+	const MatrixI& out_F, int depth)
+{
+	if (cache_)
+		cache_->Store(key, out_V, out_F, depth);
+}
+
+int Manifold::Abort(MatrixD* out_V, MatrixI* out_F)
+{
+	if (status_ == MANIFOLD_OK) {
+		status_ = (progress_ && progress_->Cancelled())
+			? MANIFOLD_CANCELLED : MANIFOLD_FAILED;
+	}
+	Logf(status_ == MANIFOLD_FAILED ? LOG_ERROR : LOG_WARNING, "%s",
+		status_ == MANIFOLD_CANCELLED ? "Cancelled"
+		: status_ == MANIFOLD_OVER_BUDGET ? "Over the memory budget"
+		: "Failed");
+	out_V->resize(0, 3);
+	out_F->resize(0, 3);
+	return -1;
+}
+
+// Peak bytes of one level with the given number of occupied leaves. Per
+// leaf: the octree (about 8/3 nodes and the leaf triangle lists) and the
+// exterior flood fill, then either the grid extraction (vcolor, v_faces,
+// quad edges) or the projector arrays for the resulting mesh, whichever
+// is larger; both coexist with the octree, the fill and the exported mesh.
+static double PeakBytes(double leaves, double num_V, double num_F)
+{
+	double octree = leaves * (8.0 / 3.0 * sizeof(Octree) + 64)
+		+ VoxelBitmap::FloodFillBytes(leaves);
+	double mesh = leaves * 2.0 * (sizeof(Vector3) + 2 * sizeof(Vector3i));
+	double extraction = leaves * 700;
+	double projector = leaves * 700
+		+ (2 * num_F + num_V) * sizeof(Vector3) + num_F * 100;
+	return 1.25 * (octree + mesh + std::max(extraction, projector));
+}
+
+double Manifold::EstimateMemory(const MatrixDRef& V, const MatrixIRef& F,
+	int depth)
+{
+	V_ = V;
+	F_ = F;
+	Normalize();
+	return EstimateBytes(depth);
+}
+
+double Manifold::EstimateBytes(int depth)
+{
+	// a trial tree this deep is cheap next to the real one
+	int trial_depth = std::min(depth, 6);
+	Octree trial(min_corner_, max_corner_, F_);
+	trial.Build(V_, trial_depth);
+	double leaves = trial.number_ * std::pow(4.0, depth - trial_depth);
+	return PeakBytes(leaves, V_.rows(), F_.rows());
+}
+
+int Manifold::FitDepth(int depth, double max_memory_mb)
+{
+	if (max_memory_mb <= 0)
+		return depth;
+	double budget = max_memory_mb * 1024 * 1024;
+	for (int d = depth; d >= 1; --d) {
+		double bytes = EstimateBytes(d);
+		Logf(LOG_INFO, "Memory estimate at depth %d: %.1lf MB (budget %.1lf MB)",
+			d, bytes / (1024 * 1024), max_memory_mb);
+		if (bytes <= budget) {
+			if (d < depth)
+				Logf(LOG_WARNING, "Lowering depth from %d to %d to fit the budget",
+					depth, d);
+			return d;
+		}
+		if (!lower_depth_)
+			break;
+	}
+	Logf(LOG_WARNING, "Refusing the job: it does not fit the memory budget");
+	status_ = MANIFOLD_OVER_BUDGET;
+	return -1;
+}
+
+void Manifold::RecordMemory(const char* stage, double bytes)
+{
+	memory_stages_.push_back(std::make_pair(std::string(stage), bytes));
+}
+
+static void PrintMemory(
+	const std::vector<std::pair<std::string, double> >& stages)
+{
+	if (!LogEnabled(LOG_INFO))
+		return;
+	std::string line = "Memory (MB):";
+	char item[128];
+	for (auto& stage : stages) {
+		snprintf(item, sizeof(item), " %s %.2lf", stage.first.c_str(),
+			stage.second / (1024 * 1024));
+		line += item;
+	}
+	Logf(LOG_INFO, "%s", line.c_str());
+}
+
+int Manifold::ProcessManifold(const MatrixDRef& V, const MatrixIRef& F,
 	int depth, MatrixD* out_V, MatrixI* out_F)
 {
+	status_ = MANIFOLD_OK;
+	CacheKey key;
+	char job[64];
+	snprintf(job, sizeof(job), "fixed %d", depth);
+	if (LoadCached(job, V, F, &key, out_V, out_F, &depth))
+		return depth;
+	V_ = V;
+	F_ = F;
+
+	Normalize();
+	depth = FitDepth(depth, max_memory_mb_);
+	if (depth < 0)
+		return Abort(out_V, out_F);
+	if (!BuildTree(depth) || !ConstructManifold())
+		return Abort(out_V, out_F);
+	ExportManifold(out_V, out_F);
+
+	MeshProjector projector;
+	projector.SetOptions(projector_options_);
+	projector.SetProgress(progress_);
+	if (!projector.Project(V_, F_, out_V, out_F))
+		return Abort(out_V, out_F);
+	RecordMemory("aabb", projector.TreeBytes());
+	RecordMemory("projector", projector.MemoryBytes());
+	PrintMemory(memory_stages_);
+	Denormalize(out_V);
+	StoreCached(key, *out_V, *out_F, depth);
+	return depth;
+}
+
+int Manifold::ProcessManifoldMultiResolution(const MatrixDRef& V,
+	const MatrixIRef& F, int depth, int levels, MatrixD* out_V, MatrixI* out_F)
+{
+	status_ = MANIFOLD_OK;
+	CacheKey key;
+	char job[64];
+	snprintf(job, sizeof(job), "multires %d %d", depth, levels);
+	if (LoadCached(job, V, F, &key, out_V, out_F, &depth))
+		return depth;
+	V_ = V;
+	F_ = F;
+
+	Normalize();
+	// the finest level dominates; coarser ones are freed before it runs
+	depth = FitDepth(depth, max_memory_mb_);
+	if (depth < 0)
+		return Abort(out_V, out_F);
+	if (tree_)
+		delete tree_;
+	tree_ = new Octree(min_corner_, max_corner_, F_);
+	int coarse_depth = std::max(1, depth - levels);
+	if (!ReportProgress(progress_, "octree", 0))
+		return Abort(out_V, out_F);
+	tree_->Build(V_, coarse_depth);
+
+	// one projector so every level shares the AABB tree of the input
+	MeshProjector projector;
+	projector.SetOptions(projector_options_);
+	projector.SetProgress(progress_);
+	projector.InitTree(V_, F_);
+	MatrixD coarse_V;
+	MatrixI coarse_F;
+	for (int d = coarse_depth; ; ++d) {
+		Logf(LOG_INFO, "Multi-resolution level %d...", d);
+		if (!BuildExterior() || !ConstructManifold())
+			return Abort(out_V, out_F);
+		ExportManifold(out_V, out_F);
+		if (d > coarse_depth)
+			projector.SetWarmStart(coarse_V, coarse_F);
+		if (!projector.Project(V_, F_, out_V, out_F))
+			return Abort(out_V, out_F);
+		RecordMemory("aabb", projector.TreeBytes());
+		RecordMemory("projector", projector.MemoryBytes());
+		PrintMemory(memory_stages_);
+		if (d >= depth)
+			break;
+		coarse_V = *out_V;
+		coarse_F = *out_F;
+		if (!ReportProgress(progress_, "octree", 0))
+			return Abort(out_V, out_F);
+		tree_->Split(V_);
+		tree_->ClearConnection();
+	}
+	Denormalize(out_V);
+	StoreCached(key, *out_V, *out_F, depth);
+	return depth;
+}
+
+int Manifold::ProcessManifoldProgressive(const MatrixDRef& V,
+	const MatrixIRef& F, const ProgressiveOptions& options,
+	MatrixD* out_V, MatrixI* out_F)
+{
+	auto start = std::chrono::steady_clock::now();
+	status_ = MANIFOLD_OK;
+	CacheKey key;
+	char job[256];
+	snprintf(job, sizeof(job), "progressive %d %d %.17g %.17g %.17g %.17g",
+		options.min_depth, options.max_depth, options.target_error,
+		options.min_improvement, options.max_seconds, options.max_memory_mb);
+	int depth = 0;
+	if (LoadCached(job, V, F, &key, out_V, out_F, &depth))
+		return depth;
 	V_ = V;
 	F_ = F;
 
-	BuildTree(depth);
-	ConstructManifold();
+	Normalize();
+	Vector3 extent = V_.colwise().maxCoeff() - V_.colwise().minCoeff();
+	FT diagonal = std::max(extent.norm(), (FT)1e-3 / scale_);
+	if (tree_)
+		delete tree_;
+	tree_ = new Octree(min_corner_, max_corner_, F_);
+	// deeper trees would overflow the packed GridIndex keys
+	int max_depth = std::max(1, std::min(options.max_depth, GRID_MAX_DEPTH));
+	depth = std::max(1, std::min(options.min_depth, max_depth));
+	// the loop only checks the levels after the first
+	double max_memory_mb = options.max_memory_mb > 0
+		? options.max_memory_mb : max_memory_mb_;
+	depth = FitDepth(depth, max_memory_mb);
+	if (depth < 0)
+		return Abort(out_V, out_F);
+	if (!ReportProgress(progress_, "octree", 0))
+		return Abort(out_V, out_F);
+	tree_->Build(V_, depth);
+
+	MeshProjector projector;
+	projector.SetOptions(projector_options_);
+	projector.SetProgress(progress_);
+	projector.InitTree(V_, F_);
+	double prev_seconds = 0;
+	FT prev_error = -1;
+	while (true) {
+		if (!BuildExterior() || !ConstructManifold())
+			return Abort(out_V, out_F);
+		ExportManifold(out_V, out_F);
+		if (!projector.Project(V_, F_, out_V, out_F))
+			return Abort(out_V, out_F);
+		RecordMemory("aabb", projector.TreeBytes());
+		RecordMemory("projector", projector.MemoryBytes());
+		PrintMemory(memory_stages_);
+
+		FT error = SampledHausdorff(projector, *out_V, *out_F) / diagonal;
+		double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		Logf(LOG_INFO, "Depth %d: face number %d, error %lf, time %lf",
+			depth, (int)out_F->rows(), error, seconds);
+
+		if (depth >= max_depth)
+			break;
+		if (options.target_error > 0 && error <= options.target_error)
+			break;
+		// interior parts of a soup never get closer, so give up on plateaus
+		if (options.min_improvement > 0 && prev_error >= 0
+			&& prev_error - error < options.min_improvement * prev_error)
+			break;
+		// Each level has about four times as many surface cells as the
+		// previous one, so predict the next level from the last.
+		double level_seconds = seconds - prev_seconds;
+		if (options.max_seconds > 0
+			&& seconds + 4 * level_seconds > options.max_seconds)
+			break;
+		if (max_memory_mb > 0) {
+			double bytes = PeakBytes(4.0 * tree_->number_, V_.rows(),
+				F_.rows());
+			if (bytes > max_memory_mb * 1024 * 1024)
+				break;
+		}
+		prev_seconds = seconds;
+		prev_error = error;
+
+		if (!ReportProgress(progress_, "octree", 0))
+			return Abort(out_V, out_F);
+		tree_->Split(V_);
+		tree_->ClearConnection();
+		depth += 1;
+	}
+	Denormalize(out_V);
+	StoreCached(key, *out_V, *out_F, depth);
+	return depth;
+}
+
+// Cells around a changed face whose output is rebuilt. Output vertices
+// settle within about a cell of their grid position, so two cells keep
+// the nearest points of the kept vertices away from the edit.
+static const int kIncrementalHalo = 2;
+
+// Union-find root with path halving.
+static int FindGroup(std::vector<int>& group, int i)
+{
+	while (group[i] != i) {
+		group[i] = group[group[i]];
+		i = group[i];
+	}
+	return i;
+}
+
+static void MergeGroups(std::vector<int>& group, int a, int b)
+{
+	a = FindGroup(group, a);
+	b = FindGroup(group, b);
+	if (a != b)
+		group[std::max(a, b)] = std::min(a, b);
+}
+
+static long long DirectedEdge(int x, int y)
+{
+	return ((long long)x << 32) | (unsigned int)y;
+}
+
+// floor(x / 2) for negative x as well
+static int FloorHalf(long long x)
+{
+	return (int)((x >= 0) ? x / 2 : -((1 - x) / 2));
+}
+
+void Manifold::GridFaceKeys(std::vector<GridFaceKey>* faces) const
+{
+	faces->resize(face_indices_.size());
+	for (int i = 0; i < (int)face_indices_.size(); ++i) {
+		unsigned long long key[3];
+		int first = 0;
+		for (int j = 0; j < 3; ++j) {
+			key[j] = vertex_keys_[face_indices_[i][j]];
+			if (key[j] < key[first])
+				first = j;
+		}
+		for (int j = 0; j < 3; ++j)
+			(*faces)[i].key[j] = key[(first + j) % 3];
+	}
+}
+
+int Manifold::ProcessManifoldIncremental(const MatrixDRef& V,
+	const MatrixIRef& F, int depth, const std::vector<int>& changed_faces,
+	MatrixD* out_V, MatrixI* out_F)
+{
+	status_ = MANIFOLD_OK;
+	// after a failure the caller's previous input is no longer ours
+	auto Fail = [&]() {
+		ClearIncremental();
+		return Abort(out_V, out_F);
+	};
+	V_ = V;
+	F_ = F;
+
+	Normalize();
+	const IncrementalState& state = incremental_;
+	bool update = state.depth == depth && state.scale == scale_
+		&& state.origin == origin_;
+	int level = update ? state.level : FitDepth(depth,
+		max_memory_mb_);
+	if (level < 0)
+		return Fail();
+	if (!BuildTree(level) || !ConstructManifold())
+		return Fail();
+	std::vector<GridFaceKey> grid_faces;
+	GridFaceKeys(&grid_faces);
+	if (update) {
+		int result = UpdateManifold(changed_faces, grid_faces, out_V, out_F);
+		if (result < 0)
+			return Fail();
+		if (result > 0) {
+			Denormalize(out_V);
+			return level;
+		}
+		Logf(LOG_INFO, "Edit is not local, rebuilding all of the output");
+	}
+
+	ExportManifold(out_V, out_F);
+	MeshProjector projector;
+	projector.SetOptions(projector_options_);
+	projector.SetProgress(progress_);
+	if (!projector.Project(V_, F_, out_V, out_F))
+		return Fail();
+	RecordMemory("aabb", projector.TreeBytes());
+	RecordMemory("projector", projector.MemoryBytes());
+	PrintMemory(memory_stages_);
+	std::vector<int> face_grid(grid_faces.size()), group(grid_faces.size());
+	for (int i = 0; i < (int)grid_faces.size(); ++i) {
+		face_grid[i] = i;
+		group[i] = i;
+	}
+	KeepIncremental(depth, level, grid_faces, projector, vertex_keys_,
+		face_grid, &group, *out_V, *out_F);
+	Denormalize(out_V);
+	return level;
+}
+
+int Manifold::UpdateManifold(const std::vector<int>& changed_faces,
+	const std::vector<GridFaceKey>& grid_faces,
+	MatrixD* out_V, MatrixI* out_F)
+{
+	const IncrementalState& state = incremental_;
+	int res = 1 << state.level;
+	if (face_indices_.empty())
+		return 0;
+
+	// Cells near the old and the new version of every changed face. Once
+	// they outnumber the surface cells there is nothing left to save.
+	int num_old = state.F.rows(), num_new = F_.rows();
+	std::vector<char> changed(std::max(num_old, num_new), 0);
+	for (auto& f : changed_faces) {
+		if (f >= 0 && f < (int)changed.size())
+			changed[f] = 1;
+	}
+	for (int f = std::min(num_old, num_new); f < (int)changed.size(); ++f)
+		changed[f] = 1;
+	std::unordered_set<long long> dirty_cells;
+	Vector3i cell_min(res, res, res), cell_max(-1, -1, -1);
+	double max_cells = tree_->number_;
+	auto MarkFace = [&](const MatrixD& V, const MatrixI& F, int f) {
+		Vector3 lo = V.row(F(f, 0)), hi = lo;
+		for (int j = 1; j < 3; ++j) {
+			lo = lo.cwiseMin(Vector3(V.row(F(f, j))));
+			hi = hi.cwiseMax(Vector3(V.row(F(f, j))));
+		}
+		Vector3i a, b;
+		double volume = 1;
+		for (int k = 0; k < 3; ++k) {
+			a[k] = std::max(0, (int)std::floor(lo[k] * res) - kIncrementalHalo);
+			b[k] = std::min(res - 1,
+				(int)std::floor(hi[k] * res) + kIncrementalHalo);
+			volume *= std::max(0, b[k] - a[k] + 1);
+		}
+		if (dirty_cells.size() + volume > max_cells)
+			return false;
+		for (int x = a[0]; x <= b[0]; ++x) {
+			for (int y = a[1]; y <= b[1]; ++y) {
+				for (int z = a[2]; z <= b[2]; ++z)
+					dirty_cells.insert(((long long)x * res + y) * res + z);
+			}
+		}
+		cell_min = cell_min.cwiseMin(a);
+		cell_max = cell_max.cwiseMax(b);
+		return true;
+	};
+	for (int f = 0; f < (int)changed.size(); ++f) {
+		if (!changed[f])
+			continue;
+		if ((f < num_old && !MarkFace(state.V, state.F, f))
+			|| (f < num_new && !MarkFace(V_, F_, f)))
+			return 0;
+	}
+	// Keys are doubled grid coordinates, so cell c spans keys 2c to 2c+2.
+	const long long bias = 1 << 20, mask = (1 << 21) - 1;
+	auto KeyDirty = [&](unsigned long long key) {
+		key >>= 1;
+		long long c[3] = {(long long)(key >> 42) - bias,
+			(long long)((key >> 21) & mask) - bias,
+			(long long)(key & mask) - bias};
+		int a[3], b[3];
+		for (int k = 0; k < 3; ++k) {
+			a[k] = std::max(FloorHalf(c[k] - 1), cell_min[k]);
+			b[k] = std::min(FloorHalf(c[k]), cell_max[k]);
+			if (a[k] > b[k])
+				return false;
+		}
+		for (int x = a[0]; x <= b[0]; ++x) {
+			for (int y = a[1]; y <= b[1]; ++y) {
+				for (int z = a[2]; z <= b[2]; ++z) {
+					if (dirty_cells.count(((long long)x * res + y) * res + z))
+						return true;
+				}
+			}
+		}
+		return false;
+	};
+
+	// Previous grid faces find their new index by key. One that is gone,
+	// ambiguous or near the edit makes its whole group dirty.
+	int num_grid = (int)grid_faces.size();
+	std::vector<int> sorted(num_grid);
+	for (int i = 0; i < num_grid; ++i)
+		sorted[i] = i;
+	std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+		return grid_faces[a] < grid_faces[b]
+			|| (grid_faces[a] == grid_faces[b] && a < b);
+	});
+	auto FindGridFace = [&](const GridFaceKey& key) {
+		auto it = std::lower_bound(sorted.begin(), sorted.end(), key,
+			[&](int a, const GridFaceKey& k) { return grid_faces[a] < k; });
+		if (it == sorted.end() || !(grid_faces[*it] == key))
+			return -1;
+		if (it + 1 != sorted.end() && grid_faces[*(it + 1)] == key)
+			return -1;
+		return *it;
+	};
+	int num_prev = (int)state.grid_faces.size();
+	std::vector<int> prev_to_new(num_prev);
+	ParallelFor(0, num_prev, [&](int g) {
+		const GridFaceKey& key = state.grid_faces[g];
+		int id = FindGridFace(key);
+		if (id >= 0 && (KeyDirty(key.key[0]) || KeyDirty(key.key[1])
+			|| KeyDirty(key.key[2])))
+			id = -1;
+		prev_to_new[g] = id;
+	});
+	std::vector<char> group_dirty(num_prev, 0);
+	for (int g = 0; g < num_prev; ++g) {
+		if (prev_to_new[g] < 0)
+			group_dirty[state.grid_group[g]] = 1;
+	}
+
+	// The kept faces must end in a simple border: one outgoing border
+	// edge per vertex, and no two border vertices with one key. Groups at
+	// a violation are rebuilt as well until that holds.
+	int num_out_V = state.out_V.rows(), num_out_F = state.out_F.rows();
+	std::vector<char> kept(num_out_F), seam(num_out_V), pinched(num_out_V);
+	std::vector<int> border_faces;
+	std::unordered_set<long long> kept_edges;
+	std::unordered_map<int, int> next_border;
+	std::unordered_map<unsigned long long, int> border_by_key;
+	bool simple = false;
+	for (int round = 0; round < 16 && !simple; ++round) {
+		seam.assign(num_out_V, 0);
+		for (int f = 0; f < num_out_F; ++f) {
+			kept[f] = !group_dirty[state.grid_group[state.face_grid[f]]];
+			if (!kept[f]) {
+				for (int j = 0; j < 3; ++j)
+					seam[state.out_F(f, j)] = 1;
+			}
+		}
+		border_faces.clear();
+		kept_edges.clear();
+		for (int f = 0; f < num_out_F; ++f) {
+			if (!kept[f] || !(seam[state.out_F(f, 0)]
+				|| seam[state.out_F(f, 1)] || seam[state.out_F(f, 2)]))
+				continue;
+			border_faces.push_back(f);
+			for (int j = 0; j < 3; ++j) {
+				kept_edges.insert(DirectedEdge(state.out_F(f, j),
+					state.out_F(f, (j + 1) % 3)));
+			}
+		}
+		next_border.clear();
+		border_by_key.clear();
+		simple = true;
+		for (auto& f : border_faces) {
+			for (int j = 0; j < 3; ++j) {
+				int u = state.out_F(f, j);
+				int w = state.out_F(f, (j + 1) % 3);
+				// a border edge has a dirty face on its other side
+				if (!seam[u] || !seam[w]
+					|| kept_edges.count(DirectedEdge(w, u)))
+					continue;
+				if (!next_border.insert(std::make_pair(u, w)).second) {
+					pinched[u] = 1;
+					simple = false;
+				}
+				unsigned long long key = state.vertex_keys[u];
+				if (key == 0)
+					continue;
+				auto it = border_by_key.insert(std::make_pair(key, u)).first;
+				if (it->second != u) {
+					pinched[u] = 1;
+					pinched[it->second] = 1;
+					simple = false;
+				}
+			}
+		}
+		if (simple)
+			break;
+		for (auto& f : border_faces) {
+			for (int j = 0; j < 3; ++j) {
+				if (pinched[state.out_F(f, j)])
+					group_dirty[state.grid_group[state.face_grid[f]]] = 1;
+			}
+		}
+	}
+	if (!simple)
+		return 0;
+
+	std::vector<char> covered(num_grid, 0);
+	for (int g = 0; g < num_prev; ++g) {
+		if (group_dirty[state.grid_group[g]])
+			continue;
+		if (covered[prev_to_new[g]])
+			return 0;
+		covered[prev_to_new[g]] = 1;
+	}
+	std::vector<int> dirty_faces;
+	for (int i = 0; i < num_grid; ++i) {
+		if (!covered[i])
+			dirty_faces.push_back(i);
+	}
+	if (dirty_faces.size() * 2 > grid_faces.size())
+		return 0;
+
+	// The patch: kept faces as they are with their vertices frozen, then
+	// the dirty grid faces with free vertices except on the border.
+	std::vector<Vector3> positions;
+	std::vector<char> frozen;
+	std::vector<unsigned long long> keys;
+	std::vector<Vector3i> faces;
+	std::vector<int> face_grid;
+	std::vector<int> prev_to_patch(num_out_V, -1), patch_to_prev;
+	for (int f = 0; f < num_out_F; ++f) {
+		if (!kept[f])
+			continue;
+		Vector3i face;
+		for (int j = 0; j < 3; ++j) {
+			int v = state.out_F(f, j);
+			if (prev_to_patch[v] < 0) {
+				prev_to_patch[v] = (int)positions.size();
+				patch_to_prev.push_back(v);
+				positions.push_back(state.out_V.row(v));
+				frozen.push_back(1);
+				keys.push_back(state.vertex_keys[v]);
+			}
+			face[j] = prev_to_patch[v];
+		}
+		faces.push_back(face);
+		face_grid.push_back(prev_to_new[state.face_grid[f]]);
+	}
+	int num_kept = (int)faces.size();
+	std::vector<int> grid_to_patch(vertices_.size(), -1);
+	auto AddVertex = [&](const Vector3& p, unsigned long long key) {
+		patch_to_prev.push_back(-1);
+		positions.push_back(p);
+		frozen.push_back(0);
+		keys.push_back(key);
+		return (int)positions.size() - 1;
+	};
+	auto PatchVertex = [&](int v) {
+		auto it = border_by_key.find(vertex_keys_[v]);
+		if (it != border_by_key.end())
+			return prev_to_patch[it->second];
+		if (grid_to_patch[v] < 0)
+			grid_to_patch[v] = AddVertex(vertices_[v], vertex_keys_[v]);
+		return grid_to_patch[v];
+	};
 
+	// An edge a->b of a dirty face meets the border b -> ... -> a, which
+	// refinement may have split: its vertices go into the face, which is
+	// then fanned from the one inserted vertex or from its centroid.
+	int num_consumed = 0;
+	std::vector<int> polygon, chain;
+	std::vector<char> inserted;
+	for (auto& g : dirty_faces) {
+		int corner[3];
+		for (int j = 0; j < 3; ++j)
+			corner[j] = PatchVertex(face_indices_[g][j]);
+		polygon.clear();
+		inserted.clear();
+		for (int j = 0; j < 3; ++j) {
+			int a = corner[j], b = corner[(j + 1) % 3];
+			polygon.push_back(a);
+			inserted.push_back(0);
+			int pa = patch_to_prev[a], pb = patch_to_prev[b];
+			if (pa < 0 || pb < 0)
+				continue;
+			chain.clear();
+			bool found = false;
+			for (int x = pb, step = 0; step < 64; ++step) {
+				auto it = next_border.find(x);
+				if (it == next_border.end())
+					break;
+				x = it->second;
+				if (x == pa) {
+					found = true;
+					break;
+				}
+				if (state.vertex_keys[x] != 0)
+					break;
+				chain.push_back(x);
+			}
+			if (!found)
+				continue;
+			num_consumed += (int)chain.size() + 1;
+			for (int k = (int)chain.size() - 1; k >= 0; --k) {
+				polygon.push_back(prev_to_patch[chain[k]]);
+				inserted.push_back(1);
+			}
+		}
+		int n = (int)polygon.size();
+		if (n == 3) {
+			faces.push_back(Vector3i(polygon[0], polygon[1], polygon[2]));
+			face_grid.push_back(g);
+		} else if (n == 4) {
+			int i = 0;
+			while (!inserted[i])
+				++i;
+			for (int k = 1; k < 3; ++k) {
+				faces.push_back(Vector3i(polygon[i], polygon[(i + k) % 4],
+					polygon[(i + k + 1) % 4]));
+				face_grid.push_back(g);
+			}
+		} else {
+			Vector3 center(0, 0, 0);
+			for (auto& v : polygon)
+				center += positions[v];
+			int c = AddVertex(center / n, 0);
+			for (int k = 0; k < n; ++k) {
+				faces.push_back(Vector3i(polygon[k], polygon[(k + 1) % n], c));
+				face_grid.push_back(g);
+			}
+		}
+	}
+
+	// Every border edge is met once and every new edge has a twin.
+	if (num_consumed != (int)next_border.size())
+		return 0;
+	std::unordered_set<long long> patch_edges;
+	for (int f = num_kept; f < (int)faces.size(); ++f) {
+		for (int j = 0; j < 3; ++j) {
+			if (!patch_edges.insert(DirectedEdge(faces[f][j],
+				faces[f][(j + 1) % 3])).second)
+				return 0;
+		}
+	}
+	for (int f = num_kept; f < (int)faces.size(); ++f) {
+		for (int j = 0; j < 3; ++j) {
+			int u = faces[f][j], w = faces[f][(j + 1) % 3];
+			int pu = patch_to_prev[u], pw = patch_to_prev[w];
+			if (pu >= 0 && pw >= 0 && kept_edges.count(DirectedEdge(pu, pw)))
+				return 0;
+			if (patch_edges.count(DirectedEdge(w, u)))
+				continue;
+			if (pu < 0 || pw < 0)
+				return 0;
+			auto it = next_border.find(pw);
+			if (it == next_border.end() || it->second != pu)
+				return 0;
+		}
+	}
+
+	Logf(LOG_INFO, "Incremental update: %d of %d grid faces rebuilt, "
+		"%d of %d output faces kept", (int)dirty_faces.size(), num_grid,
+		num_kept, num_out_F);
+	out_V->resize(positions.size(), 3);
+	out_F->resize(faces.size(), 3);
+	for (int i = 0; i < (int)positions.size(); ++i)
+		out_V->row(i) = positions[i];
+	for (int i = 0; i < (int)faces.size(); ++i)
+		out_F->row(i) = faces[i];
+	MeshProjector projector;
+	projector.SetOptions(projector_options_);
+	projector.SetProgress(progress_);
+	projector.SetFrozen(frozen);
+	// what a full run would measure on the grid mesh
+	Vector3i first = face_indices_[0];
+	projector.SetEdgeLength((vertices_[first[0]] - vertices_[first[1]]).norm());
+	if (!projector.Project(V_, F_, out_V, out_F))
+		return (progress_ && progress_->Cancelled()) ? -1 : 0;
+	RecordMemory("aabb", projector.TreeBytes());
+	RecordMemory("projector", projector.MemoryBytes());
+	PrintMemory(memory_stages_);
+	int num_survived = 0;
+	for (auto& f : projector.FaceSource()) {
+		if (f < num_kept)
+			num_survived += 1;
+	}
+	if (num_survived != num_kept)
+		return 0;
+
+	std::vector<int> group(num_grid);
+	for (int i = 0; i < num_grid; ++i)
+		group[i] = i;
+	for (int g = 0; g < num_prev; ++g) {
+		if (!group_dirty[state.grid_group[g]])
+			MergeGroups(group, prev_to_new[g],
+				prev_to_new[state.grid_group[g]]);
+	}
+	KeepIncremental(state.depth, state.level, grid_faces, projector, keys,
+		face_grid, &group, *out_V, *out_F);
+	return 1;
+}
+
+void Manifold::KeepIncremental(int depth, int level,
+	const std::vector<GridFaceKey>& grid_faces,
+	const MeshProjector& projector,
+	const std::vector<unsigned long long>& keys,
+	const std::vector<int>& face_grid, std::vector<int>* group,
+	const MatrixD& out_V, const MatrixI& out_F)
+{
+	for (auto& fused : projector.FusedFaces()) {
+		MergeGroups(*group, face_grid[fused.first],
+			face_grid[fused.second]);
+	}
+	IncrementalState& state = incremental_;
+	state.depth = depth;
+	state.level = level;
+	state.origin = origin_;
+	state.scale = scale_;
+	state.V = V_;
+	state.F = F_;
+	state.out_V = out_V;
+	state.out_F = out_F;
+	state.grid_faces = grid_faces;
+	state.grid_group.resize(group->size());
+	for (int i = 0; i < (int)group->size(); ++i)
+		state.grid_group[i] = FindGroup(*group, i);
+	const std::vector<int>& vertex_source = projector.VertexSource();
+	state.vertex_keys.resize(vertex_source.size());
+	for (int i = 0; i < (int)vertex_source.size(); ++i) {
+		state.vertex_keys[i] = (vertex_source[i] < 0) ? 0
+			: keys[vertex_source[i]];
+	}
+	const std::vector<int>& face_source = projector.FaceSource();
+	state.face_grid.resize(face_source.size());
+	for (int i = 0; i < (int)face_source.size(); ++i)
+		state.face_grid[i] = face_grid[face_source[i]];
+}
+
+void Manifold::Normalize()
+{
+	CalcBoundingBox();
+	// the cube the octree root would fit around the padded box
+	Vector3 size = max_corner_ - min_corner_;
+	scale_ = size.maxCoeff();
+	origin_ = min_corner_ - (Vector3(scale_, scale_, scale_) - size) * 0.5;
+	for (int i = 0; i < (int)V_.rows(); ++i)
+		V_.row(i) = (V_.row(i) - origin_.transpose()) / scale_;
+	min_corner_ = Vector3(0, 0, 0);
+	max_corner_ = Vector3(1, 1, 1);
+}
+
+void Manifold::Denormalize(MatrixD* V) const
+{
+	for (int i = 0; i < (int)V->rows(); ++i)
+		V->row(i) = V->row(i) * scale_ + origin_.transpose();
+}
+
+void Manifold::ExportManifold(MatrixD* out_V, MatrixI* out_F)
+{
 	*out_V = MatrixD(vertices_.size(), 3);
 	*out_F = MatrixI(face_indices_.size(), 3);
 	for (int i = 0; i < vertices_.size(); ++i)
 		out_V->row(i) = vertices_[i];
 	for (int i = 0; i < face_indices_.size(); ++i)
 		out_F->row(i) = face_indices_[i];
+}
 
-	MeshProjector projector;
-	projector.Project(V_, F_, out_V, out_F);
+FT Manifold::SampledHausdorff(const MeshProjector& projector,
+	const MatrixD& out_V, const MatrixI& out_F)
+{
+	VectorX sqrD;
+	VectorXi I;
+	MatrixD C;
+	FT max_sqrD = 0;
+
+	// output to input through the projector's tree
+	projector.SquaredDistance(out_V, &sqrD, &I, &C);
+	if (sqrD.size() > 0)
+		max_sqrD = sqrD.maxCoeff();
+
+	// input to output, sampled at input vertices and face centroids
+	MatrixD P(V_.rows() + F_.rows(), 3);
+	P.topRows(V_.rows()) = V_;
+	for (int i = 0; i < F_.rows(); ++i) {
+		P.row(V_.rows() + i) = (V_.row(F_(i, 0)) + V_.row(F_(i, 1))
+			+ V_.row(F_(i, 2))) / 3.0;
+	}
+	igl::AABB<MatrixD,3> out_tree;
+	out_tree.init(out_V, out_F);
+	out_tree.squared_distance(out_V, out_F, P, sqrD, I, C);
+	if (sqrD.size() > 0)
+		max_sqrD = std::max(max_sqrD, (FT)sqrD.maxCoeff());
+	return sqrt(max_sqrD);
 }
 
-void Manifold::BuildTree(int depth)
+bool Manifold::BuildTree(int depth)
 {
-	CalcBoundingBox();
+	if (!ReportProgress(progress_, "octree", 0))
+		return false;
+	if (tree_)
+		delete tree_;
 	tree_ = new Octree(min_corner_, max_corner_, F_);
+	tree_->Build(V_, depth);
 
-	for (int iter = 0; iter < depth; ++iter) {
-		tree_->Split(V_);
+	return BuildExterior();
+}
+
+// Bytes held by the empty-node graph: list entries plus the visited set.
+static double ConnectionBytes(Octree* tree)
+{
+	double bytes = tree->empty_neighbors_.size()
+		* (sizeof(Octree*) + 2 * sizeof(void*));
+	if (tree->level_ > 0 && tree->occupied_) {
+		for (int i = 0; i < 8; ++i)
+			bytes += ConnectionBytes(tree->children_[i]);
 	}
+	return bytes;
+}
 
-	tree_->BuildConnection();
-	tree_->BuildEmptyConnection();
+bool Manifold::BuildExterior()
+{
+	if (!ReportProgress(progress_, "octree", 1)
+		|| !ReportProgress(progress_, "exterior", 0))
+		return false;
+	memory_stages_.clear();
+	RecordMemory("octree", tree_->MemoryBytes());
+	auto start = std::chrono::steady_clock::now();
+	double bytes = 0;
+	if (exterior_method_ == EXTERIOR_BITMAP) {
+		bitmap_.FloodFill(tree_);
+	} else {
+		tree_->BuildConnection();
+		tree_->BuildEmptyConnection();
 
-	std::list<Octree*> empty_list;
-	std::set<Octree*> empty_set;
-	for (int i = 0; i < 6; ++i)
-	{
-		tree_->ExpandEmpty(empty_list, empty_set, i);
-	}
+		std::list<Octree*> empty_list;
+		std::set<Octree*> empty_set;
+		for (int i = 0; i < 6; ++i)
+		{
+			tree_->ExpandEmpty(empty_list, empty_set, i);
+		}
 
-	while ((int)empty_list.size() > 0)
-	{
-		Octree* empty = empty_list.front();
-		empty->exterior_ = 1;
-		for (std::list<Octree*>::iterator it = empty->empty_neighbors_.begin();
-			it != empty->empty_neighbors_.end(); ++it)
+		while ((int)empty_list.size() > 0)
 		{
-			if (empty_set.find(*it) == empty_set.end())
+			Octree* empty = empty_list.front();
+			empty->exterior_ = 1;
+			for (std::list<Octree*>::iterator it = empty->empty_neighbors_.begin();
+				it != empty->empty_neighbors_.end(); ++it)
 			{
-				empty_list.push_back(*it);
-				empty_set.insert(*it);
+				if (empty_set.find(*it) == empty_set.end())
+				{
+					empty_list.push_back(*it);
+					empty_set.insert(*it);
+				}
 			}
+			empty_list.pop_front();
 		}
-		empty_list.pop_front();
+		bytes = ConnectionBytes(tree_)
+			+ empty_set.size() * (sizeof(Octree*) + 4 * sizeof(void*));
+		bitmap_.Build(tree_);
 	}
+	bytes += bitmap_.MemoryBytes();
+	double seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	Logf(LOG_INFO, "Exterior (%s): %lf seconds, %.2lf MB",
+		exterior_method_ == EXTERIOR_BITMAP ? "bitmap" : "connection",
+		seconds, bytes / (1024 * 1024));
+	RecordMemory("exterior", bytes);
+	return ReportProgress(progress_, "exterior", 1);
 }
 
 void Manifold::CalcBoundingBox()
@@ -106,17 +1060,28 @@ void Manifold::CalcBoundingBox()
 	}
 }
 
-void Manifold::ConstructManifold()
+bool Manifold::ConstructManifold()
 {
+	if (!ReportProgress(progress_, "faces", 0))
+		return false;
 	std::map<GridIndex,int> vcolor;
 	std::vector<Vector3> nvertices;
 	std::vector<Vector4i> nface_indices;
 	std::vector<Vector3i> triangles;
 	std::vector<std::set<int> > v_faces;
-	tree_->ConstructFace(Vector3i(0,0,0), &vcolor, &nvertices,
+	std::vector<unsigned long long> keys;
+	tree_->ConstructFaceParallel(bitmap_, &vcolor, &nvertices,
 		&nface_indices, &v_faces);
+	RecordMemory("vcolor", vcolor.size()
+		* (sizeof(std::pair<const GridIndex,int>) + 4 * sizeof(void*)));
+	double set_bytes = v_faces.capacity() * sizeof(std::set<int>);
+	for (auto& faces : v_faces)
+		set_bytes += faces.size() * (sizeof(int) + 4 * sizeof(void*));
+	RecordMemory("v_faces", set_bytes);
+	if (!ReportProgress(progress_, "faces", 0.5))
+		return false;
 
-	SplitGrid(nface_indices, vcolor, nvertices, v_faces, triangles);
+	SplitGrid(nface_indices, vcolor, nvertices, v_faces, triangles, keys);
 	std::vector<int> hash_v(nvertices.size(),0);
 	for (int i = 0; i < (int)triangles.size(); ++i)
 	{
@@ -126,6 +1091,7 @@ void Manifold::ConstructManifold()
 		}
 	}
 	vertices_.clear();
+	vertex_keys_.clear();
 	for (int i = 0; i < (int)hash_v.size(); ++i)
 	{
 		if (hash_v[i])
@@ -134,6 +1100,7 @@ void Manifold::ConstructManifold()
 			//v_faces[vertices_.size()] = v_faces[i];
 			//v_info_[vertices_.size()] = v_info_[i];
 			vertices_.push_back(nvertices[i]);
+			vertex_keys_.push_back(keys[i]);
 		}
 	}
 	for (int i = 0; i < (int)triangles.size(); ++i)
@@ -144,6 +1111,11 @@ void Manifold::ConstructManifold()
 		}
 	}
 	face_indices_ = triangles;
+	RecordMemory("mesh", vertices_.capacity() * sizeof(Vector3)
+		+ face_indices_.capacity() * sizeof(Vector3i)
+		+ v_info_.capacity() * sizeof(GridIndex)
+		+ vertex_keys_.capacity() * sizeof(unsigned long long));
+	return ReportProgress(progress_, "faces", 1);
 }
 
 bool Manifold::SplitGrid(
@@ -151,7 +1123,8 @@ bool Manifold::SplitGrid(
 	std::map<GridIndex,int>& vcolor,
 	std::vector<Vector3>& nvertices,
 	std::vector<std::set<int> >& v_faces,
-	std::vector<Vector3i>& triangles)
+	std::vector<Vector3i>& triangles,
+	std::vector<unsigned long long>& keys)
 {
 	FT unit_len = 0;
 	v_info_.resize(vcolor.size());
@@ -160,39 +1133,47 @@ bool Manifold::SplitGrid(
 	{
 		v_info_[it->second] = it->first;
 	}
-	std::set<int> marked_v;
-	std::map<std::pair<int, int>, std::list<std::pair<int, int> > > edge_info;
-	for (int i = 0; i < (int)nface_indices.size(); ++i)
-	{
+
+	// Quad edges as sorted (min,max) keys with their multiplicity.
+	int num_quads = (int)nface_indices.size();
+	std::vector<long long> edge_keys(num_quads * 4);
+	ParallelFor(0, num_quads, [&](int i) {
 		for (int j = 0; j < 4; ++j)
 		{
-			int x = nface_indices[i][j];
-			int y = nface_indices[i][(j + 1) % 4];
-			if (x > y)
-			{
-				int temp = x;
-				x = y;
-				y = temp;
-			}
-			std::pair<int,int> edge = std::make_pair(x,y);
-			auto it = edge_info.find(edge);
-			if (it != edge_info.end())
-			{
-				it->second.push_back(std::make_pair(i,j));
-			} else
-			{
-				std::list<std::pair<int,int> > buf;
-				buf.push_back(std::make_pair(i,j));
-				edge_info.insert(std::make_pair(edge, buf));
-			}
+			edge_keys[i * 4 + j] = EdgeKey(nface_indices[i][j],
+				nface_indices[i][(j + 1) % 4]);
+		}
+	});
+	std::sort(edge_keys.begin(), edge_keys.end());
+	std::vector<int> edge_count;
+	edge_count.reserve(edge_keys.size() / 2);
+	int num_edges = 0;
+	for (int i = 0; i < (int)edge_keys.size(); ++i)
+	{
+		if (num_edges > 0 && edge_keys[num_edges - 1] == edge_keys[i]) {
+			edge_count.back() += 1;
+		} else {
+			edge_keys[num_edges++] = edge_keys[i];
+			edge_count.push_back(1);
 		}
 	}
-	for (auto it = edge_info.begin();
-		it != edge_info.end(); ++it)
+	edge_keys.resize(num_edges);
+	RecordMemory("edges", edge_keys.capacity() * sizeof(long long)
+		+ edge_count.capacity() * sizeof(int));
+	auto EdgeMultiplicity = [&](int x, int y) {
+		long long key = EdgeKey(x, y);
+		auto it = std::lower_bound(edge_keys.begin(), edge_keys.end(), key);
+		if (it == edge_keys.end() || *it != key)
+			return 0;
+		return edge_count[it - edge_keys.begin()];
+	};
+
+	std::vector<char> marked_v(nvertices.size(), 0);
+	for (int i = 0; i < num_edges; ++i)
 	{
-		if (it->second.size() > 2) {
-			marked_v.insert(it->first.first);
-			marked_v.insert(it->first.second);
+		if (edge_count[i] > 2) {
+			marked_v[edge_keys[i] >> 32] = 1;
+			marked_v[edge_keys[i] & 0xffffffff] = 1;
 		}
 	}
 	triangles.clear();
@@ -201,7 +1182,7 @@ bool Manifold::SplitGrid(
 	for (int i = 0; i < (int)nface_indices.size(); ++i)
 	{
 		int t = 0;
-		while (t < 4 && marked_v.find(nface_indices[i][t]) == marked_v.end())
+		while (t < 4 && !marked_v[nface_indices[i][t]])
 			++t;
 		if (t == 4)
 		{
@@ -214,9 +1195,9 @@ bool Manifold::SplitGrid(
 		int ind[4];
 		for (int j = 0; j < 4; ++j)
 			ind[j] = nface_indices[i][(t+j)%4];
-		bool flag1 = marked_v.find(ind[1]) != marked_v.end();
-		bool flag2 = marked_v.find(ind[2]) != marked_v.end();
-		bool flag3 = marked_v.find(ind[3]) != marked_v.end();
+		bool flag1 = marked_v[ind[1]];
+		bool flag2 = marked_v[ind[2]];
+		bool flag3 = marked_v[ind[3]];
 		GridIndex pt1 = (v_info_[ind[0]] + v_info_[ind[1]]) / 2;
 		GridIndex pt2 = (v_info_[ind[0]] + v_info_[ind[3]]) / 2;
 		GridIndex pt3 = (v_info_[ind[2]] + v_info_[ind[3]]) / 2;
@@ -326,18 +1307,42 @@ bool Manifold::SplitGrid(
 			triangles.push_back(Vector3i(ind1,ind3,ind4));
 		}
 	}
-	for (auto it = marked_v.begin();
-		it != marked_v.end(); ++it)
+
+	// Exterior tests of the eight octants around each marked vertex are
+	// independent, so evaluate them up front.
+	std::vector<int> marked_list;
+	for (int i = 0; i < (int)marked_v.size(); ++i)
 	{
-		Vector3 p = nvertices[*it];
+		if (marked_v[i])
+			marked_list.push_back(i);
+	}
+	std::vector<int> octant_mask(marked_list.size(), 0);
+	ParallelFor(0, (int)marked_list.size(), [&](int m) {
+		Vector3 p = nvertices[marked_list[m]];
+		int bit = 0;
 		for (int dimx = -1; dimx < 2; dimx += 2) {
 			for (int dimy = -1; dimy < 2; dimy += 2) {
 				for (int dimz = -1; dimz < 2; dimz += 2) {
 					Vector3 p1 = p + Vector3(dimx * half_len,
 						dimy * half_len, dimz * half_len);
-					if (tree_->IsExterior(p1))
+					if (bitmap_.IsExterior(p1))
+						octant_mask[m] |= (1 << bit);
+					bit += 1;
+				}
+			}
+		}
+	});
+	for (int m = 0; m < (int)marked_list.size(); ++m)
+	{
+		int v = marked_list[m];
+		Vector3 p = nvertices[v];
+		int bit = 0;
+		for (int dimx = -1; dimx < 2; dimx += 2) {
+			for (int dimy = -1; dimy < 2; dimy += 2) {
+				for (int dimz = -1; dimz < 2; dimz += 2) {
+					if (octant_mask[m] & (1 << (bit++)))
 					{
-						GridIndex ind = v_info_[*it];
+						GridIndex ind = v_info_[v];
 						GridIndex ind1 = ind;
 						GridIndex ind2 = ind;
 						GridIndex ind3 = ind;
@@ -352,7 +1357,7 @@ bool Manifold::SplitGrid(
 
 							nvertices.push_back(Vector3(
 								p[0]+half_len*dimx,p[1], p[2]));
-							v_faces.push_back(v_faces[*it]);
+							v_faces.push_back(v_faces[v]);
 						}
 						if (vcolor.find(ind2) == vcolor.end())
 						{
@@ -362,7 +1367,7 @@ bool Manifold::SplitGrid(
 
 							nvertices.push_back(Vector3(
 								p[0],p[1]+half_len*dimy,p[2]));
-							v_faces.push_back(v_faces[*it]);
+							v_faces.push_back(v_faces[v]);
 						}
 						if (vcolor.find(ind3) == vcolor.end())
 						{
@@ -372,7 +1377,7 @@ bool Manifold::SplitGrid(
 
 							nvertices.push_back(Vector3(
 								p[0],p[1],p[2]+half_len*dimz));
-							v_faces.push_back(v_faces[*it]);
+							v_faces.push_back(v_faces[v]);
 						}
 						int id1 = vcolor[ind1];
 						int id2 = vcolor[ind2];
@@ -388,82 +1393,111 @@ bool Manifold::SplitGrid(
 			}
 		}
 	}
-	std::map<int,std::set<std::pair<int,int> > > ocs, ecs;
-	std::set<int> odds;
-	std::set<int> evens;
-	for (int i = 0; i < (int)nvertices.size(); ++i)
-	{
-		bool flag = false;
+
+	// Classify vertices: odd ones sit on a cell edge/face/center, even ones
+	// are grid corners whose six axis edges all exist. even_len records the
+	// last neighbor distance seen, which defines unit_len below.
+	enum { kNone = 0, kOdd = 1, kEven = 2 };
+	int num_vertices = (int)nvertices.size();
+	std::vector<char> parity(num_vertices, kNone);
+	std::vector<FT> even_len(num_vertices, -1);
+	ParallelFor(0, num_vertices, [&](int i) {
+		GridIndex ind = v_info_[i];
 		for (int k = 0; k < 3; ++k)
-			if (v_info_[i].id[k] % 2 == 1)
-				flag = true;
-		if (flag) {
-			odds.insert(i);
-			ocs.insert(std::make_pair(i,std::set<std::pair<int,int> >()));
+		{
+			if (ind.id[k] % 2 == 1) {
+				parity[i] = kOdd;
+				return;
+			}
 		}
-	}
-	for (int i = 0; i < (int)nvertices.size(); ++i)
-	{
-		GridIndex ind = v_info_[i];
 		int flag = 0;
 		while (flag < 3 && ind.id[flag] % 2 == 0)
 		{
 			flag++;
 		}
 		if (flag < 3)
-			continue;
+			return;
 		for (int j = -2; j < 5; j += 4)
 		{
-			if (flag < 3)
-				break;
 			for (int k = 0; k < 3; ++k)
 			{
 				GridIndex ind1 = ind;
 				ind1.id[k] += j;
 				auto it = vcolor.find(ind1);
 				if (it == vcolor.end())
-				{
-					flag = 0;
-					break;
-				}
+					return;
 				int y = it->second;
-				unit_len = (nvertices[y] - nvertices[i]).norm();
-				std::pair<int,int> edge_id;
-				if (i < y)
-					edge_id = std::make_pair(i,y);
-				else
-					edge_id = std::make_pair(y,i);
-				if (edge_info.find(edge_id) == edge_info.end())
-				{
-					flag = 0;
-					break;
-				}
+				even_len[i] = (nvertices[y] - nvertices[i]).norm();
+				if (EdgeMultiplicity(i, y) == 0)
+					return;
 			}
 		}
-		if (flag < 3)
-			continue;
-		evens.insert(i);
-		ecs.insert(std::make_pair(i,std::set<std::pair<int,int> >()));
+		parity[i] = kEven;
+	});
+	for (int i = num_vertices - 1; i >= 0; --i)
+	{
+		if (even_len[i] >= 0) {
+			unit_len = even_len[i];
+			break;
+		}
 	}
+
+	// Vertex to (triangle, corner) incidence of odd and even vertices in
+	// CSR form; corners of a vertex are stored in triangle order.
+	std::vector<int> corner_offset(num_vertices + 1, 0);
+	for (int i = 0; i < (int)triangles.size(); ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			if (parity[triangles[i][j]] != kNone)
+				corner_offset[triangles[i][j] + 1] += 1;
+		}
+	}
+	for (int i = 0; i < num_vertices; ++i)
+		corner_offset[i + 1] += corner_offset[i];
+	std::vector<int> corners(corner_offset[num_vertices]);
+	keys.resize(num_vertices);
+	for (int i = 0; i < num_vertices; ++i)
+		keys[i] = v_info_[i].Key() * 2;
+	std::vector<int> corner_top(corner_offset.begin(), corner_offset.end() - 1);
 	for (int i = 0; i < (int)triangles.size(); ++i)
 	{
 		for (int j = 0; j < 3; ++j)
 		{
 			int x = triangles[i][j];
-			if (odds.find(x) != odds.end())
-			{
-				ocs[x].insert(std::make_pair(i,j));
-			}
-			if (evens.find(x) != evens.end())
+			if (parity[x] != kNone)
+				corners[corner_top[x]++] = i * 3 + j;
+		}
+	}
+
+	// Moves vertex i by half of offset along dir and detaches the corners on
+	// the far side of the plane to a new vertex at the opposite position.
+	auto SplitVertex = [&](int i, const Vector3& dir, FT offset) {
+		for (int c = corner_offset[i]; c < corner_offset[i + 1]; ++c)
+		{
+			int t = corners[c] / 3;
+			int j = corners[c] % 3;
+			if (dir.dot(nvertices[triangles[t][(j + 1) % 3]]
+				- nvertices[i]) < 0)
 			{
-				ecs[x].insert(std::make_pair(i,j));
+				triangles[t][j] = (int)nvertices.size();
 			}
 		}
-	}
-	for (auto it = evens.begin();
-		it != evens.end(); ++it)
-	{
-		int i = *it;
+		nvertices[i] += dir * (0.5 * offset);
+		v_faces.push_back(v_faces[i]);
+		keys.push_back(keys[i] | 1);
+		nvertices.push_back(nvertices[i]);
+		nvertices.back() -= offset * dir;
+	};
+
+	// The split decisions only read positions the same pass does not move,
+	// so they run in parallel; splits are applied in vertex order so that
+	// new vertex indices do not depend on scheduling.
+	std::vector<char> split(num_vertices, 0);
+	std::vector<Vector3> split_dir(num_vertices);
+	ParallelFor(0, num_vertices, [&](int i) {
+		if (parity[i] != kEven)
+			return;
 		Vector3 dir;
 		int count = 0;
 		for (int j = 0; j < 8; ++j)
@@ -471,34 +1505,28 @@ bool Manifold::SplitGrid(
 			Vector3 d((j&0x04)>0,(j&0x02)>0,(j&0x01)>0);
 			d = d * 2.0 - Vector3(1,1,1);
 			d = d.normalized() * (unit_len * 0.5);
-			if (!tree_->IsExterior(nvertices[i] + d))
+			if (!bitmap_.IsExterior(nvertices[i] + d))
 			{
 				dir = d.normalized();
 				count += 1;
 			}
 		}
 		if (count > 2)
-			continue;
-		std::set<std::pair<int,int> >& p = ecs[i];
-		for (auto it1 = p.begin();
-			it1 != p.end(); ++it1)
-		{
-			if (dir.dot(nvertices[triangles[it1->first][(it1->second+1)%3]]
-				-nvertices[i])<0)
-			{
-				triangles[it1->first][it1->second] = (int)nvertices.size();
-			}
-		}
-		nvertices[i] += dir * (0.5 * unit_len);
-		v_faces.push_back(v_faces[i]);
-		nvertices.push_back(nvertices[i]);
-		nvertices.back() -= unit_len * dir;
-
-	}
-	for (auto it = odds.begin();
-		it != odds.end(); ++it)
+			return;
+		split[i] = 1;
+		split_dir[i] = dir;
+	});
+	for (int i = 0; i < num_vertices; ++i)
 	{
-		int i = *it;
+		if (split[i])
+			SplitVertex(i, split_dir[i], unit_len);
+	}
+
+	std::vector<FT> split_len(num_vertices, 0);
+	ParallelFor(0, num_vertices, [&](int i) {
+		split[i] = 0;
+		if (parity[i] != kOdd)
+			return;
 		int k = 0;
 		while (v_info_[i].id[k] % 2 == 0)
 			k += 1;
@@ -507,41 +1535,34 @@ bool Manifold::SplitGrid(
 		id2 = v_info_[i];
 		id1.id[k] -= 1;
 		id2.id[k] += 1;
-		int x = vcolor[id1];
-		int y = vcolor[id2];
+		auto it1 = vcolor.find(id1);
+		auto it2 = vcolor.find(id2);
+		if (it1 == vcolor.end() || it2 == vcolor.end())
+			return;
+		int x = it1->second;
+		int y = it2->second;
 		if (x > y)
-		{
-			int temp = x;
-			x = y;
-			y = temp;
-		}
-		if (edge_info[std::make_pair(x,y)].size() > 2)
+			std::swap(x, y);
+		if (EdgeMultiplicity(x, y) > 2)
 		{
 			Vector3 vert = nvertices[x] - nvertices[y];
 			FT len = vert.norm();
 			vert /= len;
 			Vector3 dir(len*0.5,len*0.5,len*0.5);
 			dir = dir - dir.dot(vert)*vert;
-			if (!tree_->IsExterior(nvertices[i]+dir))
+			if (!bitmap_.IsExterior(nvertices[i]+dir))
 			{
 				dir = vert.cross(dir);
 			}
-			dir = dir.normalized();
-			std::set<std::pair<int,int> >& p = ocs[i];
-			for (auto it1 = p.begin();
-				it1 != p.end(); ++it1)
-			{
-				if (dir.dot(nvertices[triangles[it1->first][(it1->second+1)%3]]
-					-nvertices[i])<0)
-				{
-					triangles[it1->first][it1->second] = (int)nvertices.size();
-				}
-			}
-			nvertices[i] += dir * (0.5 * len);
-			v_faces.push_back(v_faces[i]);
-			nvertices.push_back(nvertices[i]);
-			nvertices.back() -= len * dir;
+			split[i] = 1;
+			split_dir[i] = dir.normalized();
+			split_len[i] = len;
 		}
+	});
+	for (int i = 0; i < num_vertices; ++i)
+	{
+		if (split[i])
+			SplitVertex(i, split_dir[i], split_len[i]);
 	}
 	return true;
-}
\ No newline at end of file
+}
@@ -1,36 +1,236 @@
 #ifndef MANIFOLD2_MANIFOLD_H_
 #define MANIFOLD2_MANIFOLD_H_
 
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "types.h"
 
+#include "MeshProjector.h"
 #include "Octree.h"
+#include "Progress.h"
+#include "ResultCache.h"
+#include "VoxelBitmap.h"
+
+// Options for ProcessManifoldProgressive. target_error is measured relative
+// to the diagonal of the input bounding box, min_improvement relative to the
+// previous level's error; a non-positive value disables the criterion.
+struct ProgressiveOptions {
+	ProgressiveOptions()
+	: min_depth(4), max_depth(10), target_error(2e-3), min_improvement(0.05),
+	  max_seconds(0), max_memory_mb(0)
+	{}
+	int min_depth;
+	int max_depth;
+	FT target_error;
+	FT min_improvement;
+	double max_seconds;
+	double max_memory_mb;
+};
+
+// How BuildExterior finds the empty cells that can be reached from outside.
+enum ExteriorMethod {
+	// flood fill over empty octree nodes and the voxels of surface blocks,
+	// no octree connections
+	EXTERIOR_BITMAP = 0,
+	// flood fill over the connection graph of empty octree nodes
+	EXTERIOR_CONNECTION = 1
+};
+
+// Why the last Process call returned -1.
+enum ManifoldStatus {
+	MANIFOLD_OK = 0,
+	MANIFOLD_OVER_BUDGET = 1,
+	MANIFOLD_CANCELLED = 2,
+	// an internal consistency check failed; the error was logged
+	MANIFOLD_FAILED = 3
+};
+
+// The grid vertex keys of a triangle, rotated so that the smallest comes
+// first: equal keys mean the same grid face with the same orientation.
+struct GridFaceKey {
+	unsigned long long key[3];
+	bool operator<(const GridFaceKey& other) const {
+		for (int j = 0; j < 3; ++j) {
+			if (key[j] != other.key[j])
+				return key[j] < other.key[j];
+		}
+		return false;
+	}
+	bool operator==(const GridFaceKey& other) const {
+		return key[0] == other.key[0] && key[1] == other.key[1]
+			&& key[2] == other.key[2];
+	}
+};
+
+// What ProcessManifoldIncremental keeps of its last result, in the
+// normalized frame of that input.
+struct IncrementalState {
+	IncrementalState()
+	: depth(-1), level(-1), origin(Vector3::Zero()), scale(0)
+	{}
+	// as requested and as built after the memory budget
+	int depth;
+	int level;
+	Vector3 origin;
+	FT scale;
+	MatrixD V, out_V;
+	MatrixI F, out_F;
+	// Grid faces of the level and, for each, the root of its group: grid
+	// faces whose output shares faces through edge flips or collapses,
+	// so that they can only be rebuilt together.
+	std::vector<GridFaceKey> grid_faces;
+	std::vector<int> grid_group;
+	// per output vertex its grid key, 0 for vertices added by refinement
+	std::vector<unsigned long long> vertex_keys;
+	// per output face the grid face it was cut from
+	std::vector<int> face_grid;
+};
 
 class Manifold {
 public:
 	Manifold();
 	~Manifold();
-	void ProcessManifold(const MatrixD& V, const MatrixI& F, int depth,
+	void SetProjectorOptions(const ProjectorOptions& options);
+	void SetExteriorMethod(ExteriorMethod method);
+	// With a positive budget (in MB), ProcessManifold and
+	// ProcessManifoldMultiResolution estimate their peak memory before
+	// building the octree. Over budget, they lower the depth until the
+	// estimate fits, or return -1 without output if lower_depth is false
+	// or no depth fits. ProcessManifoldProgressive applies lower_depth to
+	// its first level, with this budget unless options.max_memory_mb is
+	// positive.
+	void SetMemoryBudget(double max_memory_mb, bool lower_depth = true);
+	// Reports every stage (octree, exterior, faces and the projector
+	// phases) to progress, which is not owned and may be null. A cancelled
+	// job stops at the next report and returns -1 with empty output.
+	void SetProgress(Progress* progress);
+	// Each entry point first looks its input and settings up in cache (not
+	// owned, may be null) and stores what it computes there.
+	void SetCache(ResultCache* cache);
+	// Peak bytes expected at depth, extrapolated from a shallow trial
+	// octree since each level has about four times the surface cells.
+	double EstimateMemory(const MatrixDRef& V, const MatrixIRef& F, int depth);
+	// Bytes measured at each stage of the last level built, in stage order.
+	const std::vector<std::pair<std::string, double> >& MemoryStages() const {
+		return memory_stages_;
+	}
+	// Return the depth used, or -1 with empty output when refused by the
+	// memory budget, cancelled or failed; Status() tells which.
+	int ProcessManifold(const MatrixDRef& V, const MatrixIRef& F, int depth,
 		MatrixD* out_V, MatrixI* out_F);
+	// Builds and projects the manifold at depth - levels first, then at
+	// each finer depth up to depth, starting every level's projection from
+	// the previous level's result.
+	int ProcessManifoldMultiResolution(const MatrixDRef& V,
+		const MatrixIRef& F, int depth, int levels,
+		MatrixD* out_V, MatrixI* out_F);
+	// Refines the octree one level at a time from min_depth and stops at the
+	// first level whose sampled Hausdorff error reaches target_error, or when
+	// the time/memory budget would be exceeded. Returns the final depth, or
+	// -1 when cancelled or failed.
+	int ProcessManifoldProgressive(const MatrixDRef& V, const MatrixIRef& F,
+		const ProgressiveOptions& options, MatrixD* out_V, MatrixI* out_F);
+	// Updates the result of the previous call after a local edit.
+	// changed_faces lists the faces of F whose corners or corner positions
+	// differ from the previous input; faces past the end of either input
+	// count as changed. The octree, exterior and grid mesh are rebuilt,
+	// but only grid faces near the changed ones are projected again, with
+	// the rest of the previous output kept as it was. Runs in full, and
+	// keeps what the next call needs, on the first call, at another depth,
+	// when the edit moves the octree root cube or reaches a large part of
+	// the surface, and whenever the patch cannot be stitched in. Only full
+	// runs check the memory budget; the cache is not used.
+	int ProcessManifoldIncremental(const MatrixDRef& V, const MatrixIRef& F,
+		int depth, const std::vector<int>& changed_faces,
+		MatrixD* out_V, MatrixI* out_F);
+	// Frees the state kept by ProcessManifoldIncremental.
+	void ClearIncremental() { incremental_ = IncrementalState(); }
+	ManifoldStatus Status() const { return status_; }
 
 protected:
-	void BuildTree(int resolution);
+	// These return false when the job was cancelled.
+	bool BuildTree(int resolution);
+	bool BuildExterior();
 	void CalcBoundingBox();
-	void ConstructManifold();
+	// Maps V_ so that the octree root is the unit cube: cell boundaries are
+	// then exact dyadic fractions and grid math does not depend on where
+	// the mesh sits in world space. Denormalize maps results back.
+	void Normalize();
+	void Denormalize(MatrixD* V) const;
+	bool ConstructManifold();
+	// Empties the output of a job that stops early and sets status_ from
+	// the progress unless already set; returns -1.
+	int Abort(MatrixD* out_V, MatrixI* out_F);
+	// Peak bytes for depth with the normalized V_, F_ loaded.
+	double EstimateBytes(int depth);
+	// Lowers depth to fit max_memory_mb (if positive) as lower_depth_
+	// allows; -1 if it cannot.
+	int FitDepth(int depth, double max_memory_mb);
+	void RecordMemory(const char* stage, double bytes);
+	// Every setting that can change the output, after the job's own.
+	std::string CacheParameters(const char* job) const;
+	bool LoadCached(const char* job, const MatrixDRef& V, const MatrixIRef& F,
+		CacheKey* key, MatrixD* out_V, MatrixI* out_F, int* depth);
+	void StoreCached(const CacheKey& key, const MatrixD& out_V,
+		const MatrixI& out_F, int depth);
+	void ExportManifold(MatrixD* out_V, MatrixI* out_F);
+	void GridFaceKeys(std::vector<GridFaceKey>* faces) const;
+	// Projects a patched copy of the previous output in which only faces
+	// near changed_faces are free: 1 when done, 0 when the edit needs a
+	// full run, -1 when the projector stopped.
+	int UpdateManifold(const std::vector<int>& changed_faces,
+		const std::vector<GridFaceKey>& grid_faces,
+		MatrixD* out_V, MatrixI* out_F);
+	// Records the projected mesh for the next incremental call. keys and
+	// face_grid describe the rows of the mesh passed to the projector;
+	// group is a union-find forest over grid_faces, merged here with the
+	// faces the projector fused.
+	void KeepIncremental(int depth, int level,
+		const std::vector<GridFaceKey>& grid_faces,
+		const MeshProjector& projector,
+		const std::vector<unsigned long long>& keys,
+		const std::vector<int>& face_grid, std::vector<int>* group,
+		const MatrixD& out_V, const MatrixI& out_F);
+	FT SampledHausdorff(const MeshProjector& projector,
+		const MatrixD& out_V, const MatrixI& out_F);
+	// keys receives the grid key of every vertex in nvertices; see
+	// vertex_keys_.
 	bool SplitGrid(const std::vector<Vector4i>& nface_indices,
 		std::map<GridIndex,int>& vcolor,
 		std::vector<Vector3>& nvertices,
 		std::vector<std::set<int> >& v_faces,
-		std::vector<Vector3i>& triangles);
+		std::vector<Vector3i>& triangles,
+		std::vector<unsigned long long>& keys);
 
 private:	
 	Octree* tree_;
+	// finest-level occupancy/exterior bits of tree_, rebuilt by BuildExterior
+	VoxelBitmap bitmap_;
+	ExteriorMethod exterior_method_;
+	ProjectorOptions projector_options_;
+	double max_memory_mb_;
+	bool lower_depth_;
+	std::vector<std::pair<std::string, double> > memory_stages_;
+	Progress* progress_;
+	ManifoldStatus status_;
+	ResultCache* cache_;
 	Vector3 min_corner_, max_corner_;
+	// world position = normalized position * scale_ + origin_
+	Vector3 origin_;
+	FT scale_;
 	MatrixD V_;
 	MatrixI F_;
 
 	std::vector<Vector3> vertices_;
 	std::vector<Vector3i> face_indices_;
 	std::vector<GridIndex > v_info_;
+	// Identifies each vertex of vertices_ across levels built from the same
+	// root cube: twice the packed GridIndex, plus one for the copy that
+	// SplitGrid detaches from a vertex. Never 0.
+	std::vector<unsigned long long> vertex_keys_;
+	IncrementalState incremental_;
 
 };
 
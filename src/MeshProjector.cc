@@ -1,8 +1,12 @@
 #include "MeshProjector.h"
 
+#include <atomic>
 #include <chrono>
+#include <climits>
+#include <cmath>
 #include <fstream>
 #include <map>
+#include <random>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
@@ -10,17 +14,135 @@
 #include <Eigen/Dense>
 
 #include <igl/per_vertex_normals.h>
-#include <igl/per_face_normals.h>
 #include <igl/point_mesh_squared_distance.h>
 
 #include "Intersection.h"
 #include "IO.h"
+#include "Log.h"
+#include "Parallel.h"
+#include "Reorder.h"
 
 #define ZERO_THRES 1e-9
+
+// Half-space constraints a.x <= b around one vertex, stored per coordinate
+// so the loops over constraints vectorize. One instance per thread is
+// reused so that vertex visits do not allocate.
+struct ConstraintSet
+{
+	void clear() {
+		ax.clear();
+		ay.clear();
+		az.clear();
+		b.clear();
+		attached.clear();
+	}
+	void push_back(const Vector3& a, FT bound) {
+		ax.push_back(a[0]);
+		ay.push_back(a[1]);
+		az.push_back(a[2]);
+		b.push_back(bound);
+		attached.push_back(0);
+	}
+	int size() const {
+		return (int)b.size();
+	}
+	Vector3 row(int j) const {
+		return Vector3(ax[j], ay[j], az[j]);
+	}
+	FT dot(int j, const Vector3& d) const {
+		return ax[j] * d[0] + ay[j] * d[1] + az[j] * d[2];
+	}
+	std::vector<FT> ax, ay, az, b;
+	std::vector<char> attached;
+};
+
+// Unit normal of face f, zero for degenerate and removed faces, as
+// igl::per_face_normals computes it.
+static inline Vector3 FaceNormal(const MatrixD& V, const MatrixI& F, int f)
+{
+	if (F(f, 0) < 0)
+		return Vector3(0, 0, 0);
+	Vector3 v0 = V.row(F(f, 0));
+	Vector3 n = (Vector3(V.row(F(f, 1))) - v0).cross(
+		Vector3(V.row(F(f, 2))) - v0);
+	FT l = n.norm();
+	if (l > 0)
+		n /= l;
+	return n;
+}
+
+static void ComputeFaceNormals(const MatrixD& V, const MatrixI& F,
+	int num_F, MatrixD* FN)
+{
+	if (FN->rows() < F.rows())
+		FN->resize(F.rows(), 3);
+	ParallelFor(0, num_F, [&](int f) {
+		FN->row(f) = FaceNormal(V, F, f);
+	});
+}
+
 MeshProjector::MeshProjector()
+	: progress_(0), start_(std::chrono::steady_clock::now()),
+	  tree_ready_(false), face_normals_ready_(false), ring_ready_(false),
+	  edge_length_(0), active_generation_(0)
 {}
 
-void MeshProjector::ComputeHalfEdge()
+void MeshProjector::SetOptions(const ProjectorOptions& options)
+{
+	options_ = options;
+}
+
+void MeshProjector::SetFrozen(const std::vector<char>& frozen)
+{
+	frozen_ = frozen;
+}
+
+void MeshProjector::InitTree(const MatrixD& V, const MatrixI& F)
+{
+	V_ = V;
+	F_ = F;
+	Logf(LOG_INFO, "Initialize AABB Tree...");
+	tree_.init(V_,F_);
+	ComputeFaceNormals(V_, F_, F_.rows(), &FN_);
+	tree_ready_ = true;
+}
+
+void MeshProjector::SquaredDistance(const MatrixD& P, VectorX* sqrD,
+	VectorXi* I, MatrixD* C) const
+{
+	tree_.squared_distance(V_,F_,P,*sqrD,*I,*C);
+}
+
+template <class Matrix>
+static size_t MatrixBytes(const Matrix& m)
+{
+	return m.size() * sizeof(typename Matrix::Scalar);
+}
+
+size_t MeshProjector::TreeBytes() const
+{
+	if (!tree_ready_)
+		return 0;
+	// a binary tree with one leaf per face
+	return std::max(0, 2 * (int)F_.rows() - 1) * sizeof(tree_)
+		+ MatrixBytes(V_) + MatrixBytes(F_) + MatrixBytes(FN_);
+}
+
+size_t MeshProjector::MemoryBytes() const
+{
+	size_t bytes = MatrixBytes(out_V_) + MatrixBytes(target_V_)
+		+ MatrixBytes(out_N_) + MatrixBytes(out_FN_) + MatrixBytes(out_F_)
+		+ MatrixBytes(V2E_) + MatrixBytes(E2E_) + MatrixBytes(sqrD_)
+		+ MatrixBytes(I_);
+	bytes += (ring_offset_.capacity() + ring_.capacity() + indices_.capacity()
+		+ active_vertices_.capacity() + active_vertices_temp_.capacity()
+		+ active_stamp_.capacity() + sharp_vertices_.capacity()
+		+ vertex_source_.capacity() + face_source_.capacity()) * sizeof(int);
+	bytes += sharp_positions_.capacity() * sizeof(Vector3);
+	return bytes;
+}
+
+bool MeshProjector::ComputeHalfEdge()
 {
 	V2E_.resize(out_V_.rows());
 	E2E_.resize(out_F_.rows() * 3);
@@ -50,24 +172,47 @@ void MeshProjector::ComputeHalfEdge()
 #ifdef DEBUG_
 	for (int i = 0; i < num_V_; ++i) {
 		if (V2E_[i] == -1) {
-			printf("independent vertex! %d\n", i);
-			exit(0);
+			Logf(LOG_ERROR, "independent vertex! %d", i);
+			return false;
 		}
 	}
 	for (int i = 0; i < num_F_ * 3; ++i) {
 		if (E2E_[i] == -1) {
-			printf("Wrong edge!\n");
-			exit(0);
+			Logf(LOG_ERROR, "Wrong edge!");
+			return false;
 		}
 		if (E2E_[E2E_[i]] != i) {
-			printf("Wrong edge 2!\n");
-			exit(0);
+			Logf(LOG_ERROR, "Wrong edge 2!");
+			return false;
 		}
 	}
 #endif
+	return true;
+}
+
+void MeshProjector::BuildRings()
+{
+	ring_offset_.resize(num_V_ + 1);
+	ring_offset_[0] = 0;
+	ring_ready_ = false;
+	ParallelFor(0, num_V_, [&](int i) {
+		int count = 0;
+		if (V2E_[i] != -1)
+			ForEachRingEdge(i, [&](int deid) { count += 1; });
+		ring_offset_[i + 1] = count;
+	});
+	for (int i = 0; i < num_V_; ++i)
+		ring_offset_[i + 1] += ring_offset_[i];
+	ring_.resize(ring_offset_[num_V_]);
+	ParallelFor(0, num_V_, [&](int i) {
+		int top = ring_offset_[i];
+		if (V2E_[i] != -1)
+			ForEachRingEdge(i, [&](int deid) { ring_[top++] = deid; });
+	});
+	ring_ready_ = true;
 }
 
-void MeshProjector::Sanity(const char* log) {
+bool MeshProjector::Sanity(const char* log) {
 	for (int i = 0; i < num_F_ * 3; ++i) {
 		int deid = i;
 		int rdeid = E2E_[deid];
@@ -79,16 +224,14 @@ void MeshProjector::Sanity(const char* log) {
 		int v3 = out_F_(rdeid / 3, (rdeid + 1) % 3);
 
 		if (E2E_[E2E_[deid]] != deid) {
-			printf("%s\n", log);
-			printf("E2E Reverse! %d %d %d %d\n", i / 3, i % 3,
+			Logf(LOG_ERROR, "%s: E2E Reverse! %d %d %d %d", log, i / 3, i % 3,
 				rdeid / 3, rdeid % 3);
-			exit(0);
+			return false;
 		}
 		if (v0 != v3 || v1 != v2) {
-			printf("%s\n", log);
-			printf("E2E Conflict! %d %d %d %d\n", i / 3, i % 3,
-				rdeid / 3, rdeid % 3);
-			exit(0);
+			Logf(LOG_ERROR, "%s: E2E Conflict! %d %d %d %d", log, i / 3,
+				i % 3, rdeid / 3, rdeid % 3);
+			return false;
 		}
 	}
 	for (int i = 0; i < num_V_; ++i) {
@@ -96,11 +239,12 @@ void MeshProjector::Sanity(const char* log) {
 		if (v == -1)
 			continue;
 		if (out_F_(v / 3, v % 3) != i) {
-			printf("%s\n", log);
-			printf("Wrong V2E! %d %d %d\n", i, out_F_(v / 3, v % 3), num_V_);
-			exit(0);
+			Logf(LOG_ERROR, "%s: Wrong V2E! %d %d %d", log, i,
+				out_F_(v / 3, v % 3), num_V_);
+			return false;
 		}
 	}
+	return true;
 }
 
 void MeshProjector::SplitVertices() {
@@ -151,8 +295,14 @@ void MeshProjector::SplitVertices() {
 		}
 	}
 	out_V_.conservativeResize(num_vertices, 3);
+	vertex_source_.resize(num_vertices);
+	if (!frozen_.empty())
+		frozen_.resize(num_vertices);
 	for (auto& p : insert_vertex_info) {
 		out_V_.row(p.first) = out_V_.row(p.second);
+		vertex_source_[p.first] = vertex_source_[p.second];
+		if (!frozen_.empty())
+			frozen_[p.first] = frozen_[p.second];
 	}
 	num_V_ = num_vertices;
 }
@@ -161,10 +311,16 @@ void MeshProjector::ComputeIndependentSet() {
 	int marked_vertices = 0;
 	int group_id = 0;
 	std::vector<int> vertex_colors(num_V_, -1);
+	std::mt19937 rng(options_.seed);
+	vertex_groups_.clear();
+	for (int i = 0; i < num_V_; ++i) {
+		if (V2E_[i] == -1)
+			marked_vertices += 1;
+	}
 	while (marked_vertices < num_V_) {
+		vertex_groups_.push_back(std::vector<int>());
+		auto& group = vertex_groups_.back();
 		for (int i = 0; i < vertex_colors.size(); ++i) {
-			vertex_groups_.push_back(std::vector<int>());
-			auto& group = vertex_groups_.back();
 			if (vertex_colors[i] != -1)
 				continue;
 			if (V2E_[i] == -1)
@@ -185,101 +341,253 @@ void MeshProjector::ComputeIndependentSet() {
 				group.push_back(i);
 				marked_vertices += 1;
 			}
-			std::random_shuffle(group.begin(), group.end());
 		}
+		// Fisher-Yates on mt19937 directly; std::shuffle may differ
+		// between standard libraries
+		for (int i = (int)group.size() - 1; i > 0; --i)
+			std::swap(group[i], group[rng() % (i + 1)]);
 		group_id += 1;
 	}	
 }
 
-void MeshProjector::Project(const MatrixD& V, const MatrixI& F,
+void MeshProjector::SetWarmStart(const MatrixD& coarse_V,
+	const MatrixI& coarse_F)
+{
+	warm_V_ = coarse_V;
+	warm_F_ = coarse_F;
+}
+
+void MeshProjector::WarmStart(FT len)
+{
+	Logf(LOG_INFO, "Warm start from coarse level...");
+	igl::AABB<MatrixD,3> coarse_tree;
+	coarse_tree.init(warm_V_, warm_F_);
+	MatrixD guess;
+	VectorX sqrD;
+	VectorXi I;
+	coarse_tree.squared_distance(warm_V_, warm_F_, out_V_.topRows(num_V_),
+		sqrD, I, guess);
+
+	if (options_.ring_cache)
+		BuildRings();
+	UpdateVertexNormals(1);
+	UpdateFaceNormals();
+	// vertices in one independent set share no face, so each set moves
+	// in parallel
+	for (int sweep = 0; sweep < 2; ++sweep) {
+		for (auto& group : vertex_groups_) {
+			ParallelFor(0, (int)group.size(), [&](int i) {
+				int vid = group[i];
+				if (V2E_[vid] == -1)
+					return;
+				OptimizePosition(vid, guess.row(vid), len);
+				UpdateFaceNormal(vid);
+				UpdateVertexNormal(vid, 0);
+			});
+		}
+	}
+	ring_ready_ = false;
+	warm_V_.resize(0, 3);
+	warm_F_.resize(0, 3);
+}
+
+bool MeshProjector::Project(const MatrixD& V, const MatrixI& F,
 	MatrixD* out_V, MatrixI* out_F)
 {
-	V_ = V;
-	F_ = F;
+	start_ = std::chrono::steady_clock::now();
+	trace_.clear();
+	fused_faces_.clear();
+	// cancellation and failed checks share one exit that empties the outputs
+	auto Abort = [&]() {
+		out_V->resize(0, 3);
+		out_F->resize(0, 3);
+		frozen_.clear();
+		edge_length_ = 0;
+		vertex_source_.clear();
+		face_source_.clear();
+		return false;
+	};
+	if (!ReportProgress(progress_, "aabb", 0))
+		return Abort();
+	if (!tree_ready_)
+		InitTree(V, F);
+	if (!ReportProgress(progress_, "halfedges", 0))
+		return Abort();
 	out_V_ = *out_V;
 	out_F_ = *out_F;
+	face_normals_ready_ = false;
 
-	FT len = (out_V_.row(out_F_(0,0)) - out_V_.row(out_F_(0,1))).norm();
+	FT len = (edge_length_ > 0) ? edge_length_
+		: (out_V_.row(out_F_(0,0)) - out_V_.row(out_F_(0,1))).norm();
 
 	num_F_ = out_F_.rows();
 	num_V_ = out_V_.rows();
+	if (!frozen_.empty() && (int)frozen_.size() != num_V_) {
+		Logf(LOG_ERROR, "Frozen mask has %d entries for %d vertices",
+			(int)frozen_.size(), num_V_);
+		return Abort();
+	}
 
-	printf("Initialize AABB Tree...\n");
-	tree_.init(V_,F_);
+	std::vector<int> vertex_order, face_order;
+	if (options_.reorder) {
+		Logf(LOG_INFO, "Reorder for locality...");
+		ReorderMesh(&out_V_, &out_F_, &vertex_order, &face_order);
+		vertex_source_ = vertex_order;
+		face_source_ = face_order;
+		if (!frozen_.empty()) {
+			std::vector<char> frozen(num_V_);
+			for (int i = 0; i < num_V_; ++i)
+				frozen[i] = frozen_[vertex_order[i]];
+			frozen_.swap(frozen);
+		}
+	} else {
+		vertex_source_.resize(num_V_);
+		face_source_.resize(num_F_);
+		for (int i = 0; i < num_V_; ++i)
+			vertex_source_[i] = i;
+		for (int i = 0; i < num_F_; ++i)
+			face_source_[i] = i;
+	}
 
-	printf("Build Halfedges...\n");
-	ComputeHalfEdge();
-	printf("Split non-manifold vertices...\n");
+	Logf(LOG_INFO, "Build Halfedges...");
+	if (!ComputeHalfEdge())
+		return Abort();
+	Logf(LOG_INFO, "Split non-manifold vertices...");
 	SplitVertices();
-	printf("Rebuild Halfedges...\n");
-	ComputeHalfEdge();
+	Logf(LOG_INFO, "Rebuild Halfedges...");
+	if (!ComputeHalfEdge())
+		return Abort();
 	ComputeIndependentSet();
+	if (!ReportProgress(progress_, "halfedges", 1))
+		return Abort();
 
+	if (warm_V_.rows() > 0) {
+		WarmStart(len);
+		if (!ReportProgress(progress_, "warm start", 1))
+			return Abort();
+	}
 	IterativeOptimize(len, false);
+	if (!ReportProgress(progress_, "optimize", 1))
+		return Abort();
 
-	printf("Sharp preservation...\n");
+	Logf(LOG_INFO, "Sharp preservation...");
 	AdaptiveRefine(len, 1e-3);
+	if (!ReportProgress(progress_, "refine", 1))
+		return Abort();
+
+	// Elements appended during projection keep their place after the input
+	// ones; with stable_order the input ones go back to their input order.
+	std::vector<int> vertex_sequence(num_V_), face_sequence(num_F_);
+	for (int i = 0; i < num_V_; ++i)
+		vertex_sequence[i] = i;
+	for (int i = 0; i < num_F_; ++i)
+		face_sequence[i] = i;
+	if (options_.reorder && options_.stable_order) {
+		for (int i = 0; i < (int)vertex_order.size(); ++i)
+			vertex_sequence[vertex_order[i]] = i;
+		for (int i = 0; i < (int)face_order.size(); ++i)
+			face_sequence[face_order[i]] = i;
+	}
 
 	std::vector<int> vertex_mapping(num_V_, -1);
-	out_V->conservativeResize(num_V_, 3);
-	out_F->conservativeResize(num_F_, 3);
+	std::vector<int> vertex_source(num_V_), face_source(num_F_);
+	out_V->resize(num_V_, 3);
+	out_F->resize(num_F_, 3);
 	int num_v = 0, num_f = 0;
-	for (int i = 0; i < num_V_; ++i) {
+	for (int k = 0; k < num_V_; ++k) {
+		int i = vertex_sequence[k];
 		if (V2E_[i] > -1) {
 			out_V->row(num_v) = out_V_.row(i);
+			vertex_source[num_v] = vertex_source_[i];
 			vertex_mapping[i] = num_v;
 			num_v += 1;
 		}
 	}
-	for (int i = 0; i < num_F_; ++i) {
-		Vector3i f = out_F_.row(i);
+	for (int k = 0; k < num_F_; ++k) {
+		Vector3i f = out_F_.row(face_sequence[k]);
 		if (f[0] != -1) {
 			for (int j = 0; j < 3; ++j)
 				f[j] = vertex_mapping[f[j]];
+			face_source[num_f] = face_source_[face_sequence[k]];
 			out_F->row(num_f++) = f;
 		}
 	}
 	out_V->conservativeResize(num_v, 3);
-	out_F->conservativeResize(num_f, 3);	
+	out_F->conservativeResize(num_f, 3);
+	vertex_source.resize(num_v);
+	face_source.resize(num_f);
+	vertex_source_.swap(vertex_source);
+	face_source_.swap(face_source);
+	frozen_.clear();
+	edge_length_ = 0;
+	return true;
 }
 
 void MeshProjector::UpdateNearestDistance()
 {
-	//igl::point_mesh_squared_distance(out_V_, V_, F_, sqrD_, I_, target_V_);
-	tree_.squared_distance(V_,F_,out_V_,sqrD_,I_,target_V_);
+	if (frozen_.empty()) {
+		//igl::point_mesh_squared_distance(out_V_, V_, F_, sqrD_, I_, target_V_);
+		tree_.squared_distance(V_,F_,out_V_,sqrD_,I_,target_V_);
+		return;
+	}
+	// Frozen vertices only need their nearest point where refinement may
+	// split one of their edges, next to a free vertex; the others count as
+	// lying on the surface.
+	int rows = out_V_.rows();
+	std::vector<char> needed(rows, 0);
+	for (int f = 0; f < num_F_; ++f) {
+		if (out_F_(f, 0) == -1)
+			continue;
+		if (frozen_[out_F_(f, 0)] && frozen_[out_F_(f, 1)]
+			&& frozen_[out_F_(f, 2)])
+			continue;
+		for (int j = 0; j < 3; ++j)
+			needed[out_F_(f, j)] = 1;
+	}
+	std::vector<int> query;
+	for (int i = 0; i < num_V_; ++i) {
+		if (needed[i])
+			query.push_back(i);
+	}
+	MatrixD P(query.size(), 3), targetP;
+	VectorX sqrD;
+	VectorXi I;
+	for (int i = 0; i < (int)query.size(); ++i)
+		P.row(i) = out_V_.row(query[i]);
+	tree_.squared_distance(V_,F_,P,sqrD,I,targetP);
+	target_V_ = out_V_;
+	sqrD_.setZero(rows);
+	I_.setZero(rows);
+	for (int i = 0; i < (int)query.size(); ++i) {
+		target_V_.row(query[i]) = targetP.row(i);
+		sqrD_[query[i]] = sqrD[i];
+		I_[query[i]] = I[i];
+	}
 }
 
 void MeshProjector::UpdateFaceNormal(int i)
 {
 	if (V2E_[i] == -1)
 		return;
-	int deid = V2E_[i];
-	int deid0 = deid;
-	do {
-		int f = deid / 3;
-		int v0 = out_F_(f, deid % 3);
-		int v1 = out_F_(f, (deid + 1) % 3);
-		int v2 = out_F_(f, (deid + 2) % 3);
-		Vector3 d0 = out_V_.row(v1) - out_V_.row(v0);
-		Vector3 d1 = out_V_.row(v2) - out_V_.row(v0);
-		d0.normalize();
-		d1.normalize();
-		auto vn = d0.cross(d1);		
-		double l = vn.norm();
-		if (l > 0)
-			vn /= l;
-		out_FN_.row(f) = vn;
-	} while (deid0 != deid);
+	ForEachRingEdge(i, [&](int deid) {
+		out_FN_.row(deid / 3) = FaceNormal(out_V_, out_F_, deid / 3);
+	});
+}
+
+void MeshProjector::UpdateFaceNormals()
+{
+	if (face_normals_ready_)
+		return;
+	ComputeFaceNormals(out_V_, out_F_, num_F_, &out_FN_);
+	face_normals_ready_ = true;
 }
 
 void MeshProjector::UpdateVertexNormal(int i, int conservative) {
 	if (V2E_[i] == -1) {
 		return;
 	}
-	int deid = V2E_[i];
-	int deid0 = deid;
 	Vector3 n(0,0,0);
-	do {
+	ForEachRingEdge(i, [&](int deid) {
 		int f = deid / 3;
 		int v0 = out_F_(f, deid % 3);
 		int v1 = out_F_(f, (deid + 1) % 3);
@@ -292,11 +600,10 @@ void MeshProjector::UpdateVertexNormal(int i, int conservative) {
 		double l = vn.norm();
 		vn = vn * (asin(l) / l);
 		n += vn;
-		deid = E2E_[deid / 3 * 3 + (deid + 2) % 3];
-	} while (deid0 != deid);
+	});
 
 	if (conservative) {
-		do {
+		ForEachRingEdge(i, [&](int deid) {
 			int f = deid / 3;
 			int v0 = out_F_(f, deid % 3);
 			int v1 = out_F_(f, (deid + 1) % 3);
@@ -307,8 +614,7 @@ void MeshProjector::UpdateVertexNormal(int i, int conservative) {
 			if (n.dot(vn) < 0) {
 				n -= n.dot(vn) * vn;
 			}
-			deid = E2E_[deid / 3 * 3 + (deid + 2) % 3];
-		} while (deid0 != deid);
+		});
 	}
 
 	out_N_.row(i) = n.normalized();
@@ -318,13 +624,13 @@ void MeshProjector::UpdateVertexNormals(int conservative)
 {
 	if (out_N_.rows() < num_V_)
 		out_N_.resize(num_V_, 3);
-	for (int i = 0; i < num_V_; ++i) {
+	ParallelFor(0, num_V_, [&](int i) {
 		UpdateVertexNormal(i, conservative);
-	}
+	});
 }
 
 int MeshProjector::BoundaryCheck() {
-	igl::per_face_normals(out_V_, out_F_, out_FN_);
+	UpdateFaceNormals();
 	int consistent = 0;
 	int inconsistent = 0;
 	for (int i = 0; i < num_V_; ++i) {
@@ -335,7 +641,7 @@ int MeshProjector::BoundaryCheck() {
 			Vector3 fn = out_FN_.row(deid / 3);
 			if (n.dot(fn) < -ZERO_THRES) {
 				inconsistent += 1;
-				printf("%d %d %f: <%f %f %f> <%f %f %f>\n",
+				LOG_VERBOSE("%d %d %f: <%f %f %f> <%f %f %f>",
 					i, deid / 3, n.dot(fn),
 					n[0], n[1], n[2],
 					fn[0], fn[1], fn[2]);
@@ -349,19 +655,24 @@ int MeshProjector::BoundaryCheck() {
 }
 
 void MeshProjector::IterativeOptimize(FT len, bool initialized) {
-	printf("Gauss-seidel update...\n");
+	Logf(LOG_INFO, "Gauss-seidel update...");
+	if (options_.ring_cache)
+		BuildRings();
+	if ((int)active_stamp_.size() < num_V_)
+		active_stamp_.resize(num_V_, -1);
 	if (!initialized) {
 		indices_.resize(num_V_);
 		UpdateVertexNormals(1);
 		UpdateNearestDistance();
-		igl::per_face_normals(out_V_, out_F_, out_FN_);
+		UpdateFaceNormals();
 		active_vertices_.resize(num_V_);
 		active_vertices_temp_.resize(num_V_);
-		sharp_vertices_.resize(num_V_, 0);
+		sharp_vertices_.assign(num_V_, 0);
+		num_active_ = 0;
 		for (int i = 0; i < num_V_; ++i) {
-			active_vertices_[i] = i;
+			if (frozen_.empty() || !frozen_[i])
+				active_vertices_[num_active_++] = i;
 		}
-		num_active_ = num_V_;
 	}
 
 	//Sanity("Iterative...");
@@ -378,22 +689,33 @@ void MeshProjector::IterativeOptimize(FT len, bool initialized) {
 			}
 		}
 		*/
-		printf("Iter %d with active vertex number %d    \r", iter, num_active_);
-		fflush(stdout);
+		LOG_VERBOSE("Iter %d with active vertex number %d", iter, num_active_);
+		// the visit budget bounds the pass, so it measures its progress
+		double fraction = (options_.max_visit_ratio > 0)
+			? vertex_count / (options_.max_visit_ratio * num_V_) : 0;
+		if (options_.max_iterations > 0)
+			fraction = std::max(fraction, (double)iter / options_.max_iterations);
+		if (!ReportProgress(progress_, "optimize", std::min(fraction, 1.0)))
+			break;
 		vertex_count += num_active_;
-		if (vertex_count > 5 * num_V_)
+		if (vertex_count > options_.max_visit_ratio * num_V_)
 			break;
-		for (int i = 0; i < num_active_; ++i) {
-			int vid = active_vertices_[i];
-			indices_[i] = std::make_pair(sqrD_[vid], vid);
-		}
+		if (options_.max_iterations > 0 && iter >= options_.max_iterations)
+			break;
+		if (options_.max_seconds > 0 && std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start_).count()
+			> options_.max_seconds)
+			break;
+		ProjectorIterationStats stats;
+		stats.iteration = iter;
+		stats.num_active = num_active_;
+		ScheduleActive();
 		bool changed = false;
-		std::sort(indices_.begin(), indices_.begin() + num_active_);
 		double max_change = 0;
 		int num_active_temp = 0;
 
-		for (int i = num_active_ - 1; i >= 0; --i) {
-			int vid = indices_[i].second;
+		for (int i = 0; i < num_active_; ++i) {
+			int vid = indices_[i];
 			if (V2E_[vid] == -1)
 				continue;
 
@@ -444,23 +766,60 @@ void MeshProjector::IterativeOptimize(FT len, bool initialized) {
 			}
 		}
 
-		std::unordered_set<int> novel_activate;
+		stats.max_change = std::abs(max_change) / len;
+		stats.max_distance = -1;
+		stats.mean_distance = -1;
+		bool measure = options_.trace || options_.target_max_distance > 0
+			|| options_.target_mean_distance > 0;
+		if (measure) {
+			// (max sqrD, sum of distances, live vertex count)
+			Vector3 sum = ParallelReduce(0, num_V_, Vector3(0, 0, 0),
+				[&](int i) {
+					if (V2E_[i] == -1)
+						return Vector3(0, 0, 0);
+					return Vector3(sqrD_[i], sqrt(sqrD_[i]), 1);
+				},
+				[](const Vector3& a, const Vector3& b) {
+					return Vector3(std::max(a[0], b[0]), a[1] + b[1],
+						a[2] + b[2]);
+				});
+			stats.max_distance = sqrt(sum[0]) / len;
+			stats.mean_distance = (sum[2] > 0) ? sum[1] / sum[2] / len : 0;
+		}
+		stats.seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start_).count();
+		trace_.push_back(stats);
+		if (options_.trace) {
+			Logf(LOG_INFO, "Iter %d: active %d, max change %lf, "
+				"max distance %lf, mean distance %lf, time %lf", stats.iteration,
+				stats.num_active, stats.max_change, stats.max_distance,
+				stats.mean_distance, stats.seconds);
+		}
+		if (options_.min_improvement > 0
+			&& stats.max_change < options_.min_improvement)
+			break;
+		if ((options_.target_max_distance > 0
+			|| options_.target_mean_distance > 0)
+			&& (options_.target_max_distance <= 0
+			|| stats.max_distance <= options_.target_max_distance)
+			&& (options_.target_mean_distance <= 0
+			|| stats.mean_distance <= options_.target_mean_distance))
+			break;
+
+		if (++active_generation_ == INT_MAX) {
+			std::fill(active_stamp_.begin(), active_stamp_.end(), -1);
+			active_generation_ = 0;
+		}
+		num_active_ = 0;
 		for (int i = 0; i < num_active_temp; ++i) {
 			int p = active_vertices_temp_[i];
-			novel_activate.insert(p);
+			Activate(p);
 			if (V2E_[p] == -1)
 				continue;
-			int deid = V2E_[p];
-			int deid0 = deid;
-			do {
-				novel_activate.insert(out_F_(deid / 3, (deid + 1) % 3));
-				deid = E2E_[deid / 3 * 3 + (deid + 2) % 3];
-			} while (deid0 != deid);
+			ForEachRingEdge(p, [&](int deid) {
+				Activate(out_F_(deid / 3, (deid + 1) % 3));
+			});
 		}
-
-		num_active_ = 0;
-		for (auto& p : novel_activate)
-			active_vertices_[num_active_++] = p;
 		/*
 		if (iter == 2)
 			PreserveSharpFeatures(len);
@@ -469,7 +828,35 @@ void MeshProjector::IterativeOptimize(FT len, bool initialized) {
 			break;
 		iter += 1;
 	}
-	printf("\n");
+	ring_ready_ = false;
+}
+
+void MeshProjector::ScheduleActive() {
+	// Four buckets per octave below the largest distance; anything more
+	// than 2^-64 of it shares the last bucket.
+	const int kBucketsPerOctave = 4;
+	const int kNumBuckets = 64 * kBucketsPerOctave + 1;
+	FT max_sqrD = 0;
+	for (int i = 0; i < num_active_; ++i)
+		max_sqrD = std::max(max_sqrD, sqrD_[active_vertices_[i]]);
+
+	bucket_offset_.assign(kNumBuckets + 1, 0);
+	bucket_index_.resize(num_active_);
+	for (int i = 0; i < num_active_; ++i) {
+		FT d = sqrD_[active_vertices_[i]];
+		int bucket = kNumBuckets - 1;
+		if (d > 0) {
+			FT octaves = std::log2(max_sqrD / d);
+			if (octaves < kNumBuckets / kBucketsPerOctave)
+				bucket = (int)(octaves * kBucketsPerOctave);
+		}
+		bucket_index_[i] = bucket;
+		bucket_offset_[bucket + 1] += 1;
+	}
+	for (int i = 0; i < kNumBuckets; ++i)
+		bucket_offset_[i + 1] += bucket_offset_[i];
+	for (int i = 0; i < num_active_; ++i)
+		indices_[bucket_offset_[bucket_index_[i]]++] = active_vertices_[i];
 }
 
 void MeshProjector::Highlight(int id, FT len) {
@@ -481,7 +868,7 @@ void MeshProjector::Highlight(int id, FT len) {
 		d = sqrt(d);
 	std::sort(distances.rbegin(), distances.rend());
 	max_dis = distances[0];
-	printf("Max distance %lf\n", max_dis / len);
+	Logf(LOG_DEBUG, "Max distance %lf", max_dis / len);
  	char buffer[1024];
  	sprintf(buffer, "%05d-tri.obj", id);
  	WriteOBJ(buffer, out_V_, out_F_);
@@ -490,12 +877,13 @@ void MeshProjector::Highlight(int id, FT len) {
  	for (int i = 0; i < sqrD_.size(); ++i) {
  		double dis = sqrt(sqrD_[i]);
  		if (dis > max_dis - 1e-7) {
- 			printf("Id %d\n", i);
+ 			Logf(LOG_DEBUG, "Id %d", i);
  			Vector3 d1 = target_V_.row(i) - out_V_.row(i);
- 			printf("Distance0 %lf\n", d1.norm());
+ 			Logf(LOG_DEBUG, "Distance0 %lf", d1.norm());
  			OptimizePosition(i, target_V_.row(i), len, true);
+			UpdateFaceNormal(i);
  			Vector3 d2 = target_V_.row(i) - out_V_.row(i);
- 			printf("Distance1 %lf\n", d2.norm());
+ 			Logf(LOG_DEBUG, "Distance1 %lf", d2.norm());
  			Vector3 v = out_V_.row(i);
  			Vector3 n = out_N_.row(i);
  			os << "v " << v[0] << " " << v[1] << " " << v[2] << " 0 0.99 0\n";
@@ -508,57 +896,87 @@ void MeshProjector::Highlight(int id, FT len) {
  	os.close();
 }
 
+void MeshProjector::ReserveElements(int num_V, int num_F) {
+	if (num_V > out_V_.rows()) {
+		int capacity = std::max(num_V, (int)out_V_.rows() * 3 / 2);
+		out_V_.conservativeResize(capacity, 3);
+		out_N_.conservativeResize(capacity, 3);
+		target_V_.conservativeResize(capacity, 3);
+		sqrD_.conservativeResize(capacity);
+		I_.conservativeResize(capacity);
+		indices_.resize(capacity);
+		active_vertices_.resize(capacity);
+		active_vertices_temp_.resize(capacity);
+		sharp_vertices_.resize(capacity);
+		vertex_source_.resize(capacity);
+		if (!frozen_.empty())
+			frozen_.resize(capacity, 0);
+	}
+	if (num_V > V2E_.size())
+		V2E_.conservativeResize(out_V_.rows());
+	if (num_F > out_F_.rows()) {
+		int capacity = std::max(num_F, (int)out_F_.rows() * 3 / 2);
+		out_F_.conservativeResize(capacity, 3);
+		out_FN_.conservativeResize(capacity, 3);
+		face_source_.resize(capacity);
+	}
+	if (num_F * 3 > E2E_.size())
+		E2E_.conservativeResize(out_F_.rows() * 3);
+}
+
 void MeshProjector::AdaptiveRefine(FT len, FT ratio) {
+	// edges between two frozen vertices are never split or flipped
+	auto Frozen = [&](int deid) {
+		return !frozen_.empty() && frozen_[out_F_(deid / 3, deid % 3)]
+			&& frozen_[out_F_(deid / 3, (deid + 1) % 3)];
+	};
 	std::vector<int> candidates;
 	candidates.reserve(num_F_ * 3 / 2);
 	for (int i = 0; i < num_F_ * 3; ++i) {
-		if (E2E_[i] > i)
+		if (E2E_[i] > i && !Frozen(i))
 			candidates.push_back(i);
 	}
 
-	double max_dis = 0;
-	for (int i = 0; i < num_V_; ++i) {
-		double dis = sqrt(sqrD_[i]);
-		if (dis > max_dis)
-			max_dis = dis;
-	}
-	
-	auto AddVertex = [&](const Vector3& p, const Vector3& n,
-		const Vector3& tar_p, const FT& sqr_dis, int face_index, int sharp) {
-		if (num_V_ >= out_V_.rows()) {
-			out_V_.conservativeResize(out_V_.rows() * 2, 3);
-			out_N_.conservativeResize(out_N_.rows() * 2, 3);
-			target_V_.conservativeResize(target_V_.rows() * 2, 3);
-			sqrD_.conservativeResize(sqrD_.rows() * 2);
-			I_.conservativeResize(I_.size() * 2);
-			indices_.resize(indices_.size() * 2);
-			active_vertices_.resize(active_vertices_.size() * 2);
-			active_vertices_temp_.resize(active_vertices_temp_.size() * 2);
-			sharp_vertices_.resize(sharp_vertices_.size() * 2);
-		}
-		out_V_.row(num_V_) = p;
-		out_N_.row(num_V_) = n;
-		target_V_.row(num_V_) = tar_p;
-		sqrD_[num_V_] = sqr_dis;
-		I_[num_V_] = face_index;
-		sharp_vertices_[num_V_] = sharp;
-		num_V_ += 1;
+	auto PairDedge = [&](int e1, int e2) {
+		E2E_[e1] = e2;
+		E2E_[e2] = e1;
 	};
 
-	auto AddFace = [&](const Vector3i& f, const Vector3& n) {
-		if (num_F_ >= out_F_.rows()) {
-			out_F_.conservativeResize(out_F_.rows() * 2, 3);
-			out_FN_.conservativeResize(out_FN_.rows() * 2, 3);
-		}
-		out_F_.row(num_F_) = f;
-		out_FN_.row(num_F_) = n;
-		num_F_ += 1;
+	// Splits dedge deid (a->b in face f) and its twin rdeid (b->a in face
+	// g) at the new vertex m: f becomes (a,m,c), g becomes (b,m,d), and the
+	// new faces are f2 = (m,b,c) and g2 = (m,a,d). Only the twins of f, g,
+	// f2, g2 and of the outer edges (b,c) and (a,d) change.
+	auto SplitEdge = [&](int deid, int rdeid, int m, int f2, int g2) {
+		int f = deid / 3, j = deid % 3;
+		int g = rdeid / 3, k = rdeid % 3;
+		int a = out_F_(f, j);
+		int b = out_F_(f, (j + 1) % 3);
+		int c = out_F_(f, (j + 2) % 3);
+		int d = out_F_(g, (k + 2) % 3);
+		int e_bc = E2E_[f * 3 + (j + 1) % 3];
+		int e_ad = E2E_[g * 3 + (k + 1) % 3];
+
+		out_F_(f, (j + 1) % 3) = m;
+		out_F_(g, (k + 1) % 3) = m;
+		out_F_.row(f2) = Vector3i(m, b, c);
+		out_F_.row(g2) = Vector3i(m, a, d);
+		out_FN_.row(f2) = out_FN_.row(f);
+		out_FN_.row(g2) = out_FN_.row(g);
+		face_source_[f2] = face_source_[f];
+		face_source_[g2] = face_source_[g];
+
+		PairDedge(f * 3 + j, g2 * 3);
+		PairDedge(g * 3 + k, f2 * 3);
+		PairDedge(f * 3 + (j + 1) % 3, f2 * 3 + 2);
+		PairDedge(g * 3 + (k + 1) % 3, g2 * 3 + 2);
+		PairDedge(f2 * 3 + 1, e_bc);
+		PairDedge(g2 * 3 + 1, e_ad);
 	};
 
-	MatrixD origin_FN;
-	igl::per_face_normals(V_, F_, origin_FN);	
-
+	std::vector<int> face_stamp;
 	for (int iter = 0; iter < 2; ++iter) {
+		if (!ReportProgress(progress_, "refine", iter / 2.0))
+			return;
 		// Collect dedges to split
 		MatrixD P;
 		MatrixD targetP;
@@ -569,14 +987,14 @@ void MeshProjector::AdaptiveRefine(FT len, FT ratio) {
 
 		for (int repeat = 0; repeat < 2; ++repeat) {
 			P.resize(candidates.size(), 3);
-			sharp.resize(candidates.size(), 0);
-			for (int i = 0; i < candidates.size(); ++i) {
+			sharp.assign(candidates.size(), 0);
+			ParallelFor(0, (int)candidates.size(), [&](int i) {
 				int deid = candidates[i];
 				int v0 = out_F_(deid / 3, deid % 3);
 				int v1 = out_F_(deid / 3, (deid + 1) % 3);
 
 				P.row(i) = (out_V_.row(v0) + out_V_.row(v1)) * 0.5;
-			}
+			});
 
 			//igl::point_mesh_squared_distance(P, V_, F_, sqrD_, I_, targetP);
 			tree_.squared_distance(V_,F_,P,sqrD,I,targetP);
@@ -584,7 +1002,8 @@ void MeshProjector::AdaptiveRefine(FT len, FT ratio) {
 			top = 0;
 			for (int i = 0; i < sqrD.size(); ++i) {
 				double dis = sqrt(sqrD[i]);
-				if (dis > len * ratio) {
+				// flips may have turned a candidate into a frozen edge
+				if (dis > len * ratio && !Frozen(candidates[i])) {
 					P.row(top) = P.row(i);
 					targetP.row(top) = targetP.row(i);
 					sqrD[top] = sqrD[i];
@@ -601,10 +1020,7 @@ void MeshProjector::AdaptiveRefine(FT len, FT ratio) {
 		}
 
 		//printf("candidates %d\n", candidates.size());
-		for (int i = 0; i < candidates.size(); ++i) {
-			if (sqrt(sqrD[i]) <= len * ratio)
-				continue;
-
+		ParallelFor(0, top, [&](int i) {
 			int deid = candidates[i];
 			int v0 = out_F_(deid / 3, deid % 3);
 			int v1 = out_F_(deid / 3, (deid + 1) % 3);
@@ -613,14 +1029,14 @@ void MeshProjector::AdaptiveRefine(FT len, FT ratio) {
 			int src_f1 = I_[v1];
 
 			Vector3 p0 = V_.row(F_(src_f0, 0));
-			Vector3 n0 = origin_FN.row(src_f0);
+			Vector3 n0 = FN_.row(src_f0);
 
 			Vector3 p1 = V_.row(F_(src_f1, 0));
-			Vector3 n1 = origin_FN.row(src_f1);
+			Vector3 n1 = FN_.row(src_f1);
 
 			Vector3 o, t;
 			if (!PlaneIntersect(p0, n0, p1, n1, &o, &t)) {
-				continue;
+				return;
 			}
 
 			Vector3 np = P.row(i);
@@ -630,146 +1046,123 @@ void MeshProjector::AdaptiveRefine(FT len, FT ratio) {
 				sqrD[i] = (np - ntarget1).squaredNorm();
 				sharp[i] = 1;
 			}
-		}
+		});
 
 		int prev_vertex_num = num_V_;
 		int prev_face_num = num_F_;
 
 		//Sanity("Before some operation...\n");
 
-		// insert vertices
-		std::map<int, Vector3i > face_splits;
+		// Each split adds one vertex and two faces, so reserve for all of
+		// them up front. Splits are applied in batches whose faces (and the
+		// faces across the edges that move to new faces) are disjoint.
+		ReserveElements(num_V_ + top, num_F_ + 2 * top);
+		face_stamp.assign(num_F_ + 2 * top, -1);
+		std::vector<std::pair<int, int> > split_edges(top);
 		for (int i = 0; i < top; ++i) {
 			int deid = candidates[i];
-			for (int j = 0; j < 2; ++j) {
-				int f = deid / 3;
-				auto it = face_splits.find(f);
-				if (it == face_splits.end()) {
-					Vector3i v(-1, -1, -1);
-					v[deid % 3] = num_V_;
-					face_splits[f] = v;
-				} else {
-					it->second[deid % 3] = num_V_;
-				}
-				deid = E2E_[deid];
-			}
-
-			int v0 = out_F_(deid / 3, deid % 3);
-			AddVertex(P.row(i), out_N_.row(v0), targetP.row(i),
-				sqrD[i], I[i], sharp[i]);
+			split_edges[i] = std::make_pair(out_F_(deid / 3, deid % 3),
+				out_F_(deid / 3, (deid + 1) % 3));
 		}
-
-		// insert faces
-		std::map<std::pair<int, int>, int> dedges;
-		for (auto& info : face_splits) {
-			int f = info.first;
-			Vector3 fn = out_FN_.row(f);
-			auto splits = info.second;
-
-			int count = 0;
-			for (int j = 0; j < 3; ++j) {
-				if (splits[j] >= 0)
-					count += 1;
-			}
-			if (count == 3) {
-				int v0 = out_F_(f, 0);
-				int v1 = out_F_(f, 1);
-				int v2 = out_F_(f, 2);
-
-				int nv0 = splits[0];
-				int nv1 = splits[1];
-				int nv2 = splits[2];
-
-				out_F_.row(f) = Vector3i(v0, nv0, nv2);
-
-				AddFace(Vector3i(nv0, nv1, nv2), fn);
-				AddFace(Vector3i(nv0, v1, nv1), fn);
-				AddFace(Vector3i(nv2, nv1, v2), fn);
-			}
-			else if (count == 2) {
-				int j = 0;
-				while (splits[j] != -1) {
-					j += 1;
-				}
-				int v0 = out_F_(f, j);
-				int v1 = out_F_(f, (j + 1) % 3);
-				int v2 = out_F_(f, (j + 2) % 3);
-				int nv0 = splits[(j + 1) % 3];
-				int nv1 = splits[(j + 2) % 3];
-
-				dedges[std::make_pair(v1, v0)] = E2E_[f * 3 + j];
-
-				out_F_(f, (j + 2) % 3) = nv0;
-				AddFace(Vector3i(v0, nv0, nv1), fn);
-				AddFace(Vector3i(nv1, nv0, v2), fn);
-			}
-			else if (count == 1) {
-				int j = 0;
-				while (splits[j] == -1) {
-					j += 1;
+		std::vector<int> pending(top), next_pending, dedges;
+		std::vector<int> batch, batch_dedges, batch_twins;
+		std::vector<int> touched_faces;
+		for (int i = 0; i < top; ++i)
+			pending[i] = i;
+		for (int round = 0; !pending.empty(); ++round) {
+			// earlier batches may have moved the edge to another face
+			dedges.resize(pending.size());
+			ParallelFor(0, (int)pending.size(), [&](int i) {
+				if (round == 0) {
+					dedges[i] = candidates[pending[i]];
+					return;
 				}
-				int v0 = out_F_(f, j);
-				int v1 = out_F_(f, (j + 1) % 3);
-				int v2 = out_F_(f, (j + 2) % 3);
-
-				dedges[std::make_pair(v2, v1)] = E2E_[f * 3 + (j + 1) % 3];
-				dedges[std::make_pair(v0, v2)] = E2E_[f * 3 + (j + 2) % 3];
-
-				int nv0 = splits[j];
-				out_F_(f, (j + 1) % 3) = nv0;
-				AddFace(Vector3i(nv0, v1, v2), fn);
-				if (dedges.count(std::make_pair(v1, v2))) {
-					dedges[std::make_pair(v1, v2)] = (num_F_ - 1) * 3 + 1;
+				int v1 = split_edges[pending[i]].second;
+				dedges[i] = -1;
+				ForEachRingEdge(split_edges[pending[i]].first, [&](int deid) {
+					if (out_F_(deid / 3, (deid + 1) % 3) == v1)
+						dedges[i] = deid;
+				});
+			});
+
+			batch.clear();
+			batch_dedges.clear();
+			batch_twins.clear();
+			next_pending.clear();
+			for (int i = 0; i < (int)pending.size(); ++i) {
+				int deid = dedges[i];
+				if (deid == -1)
+					continue;
+				int rdeid = E2E_[deid];
+				if (rdeid == -1)
+					continue;
+				int e_bc = E2E_[deid / 3 * 3 + (deid + 1) % 3];
+				int e_ad = E2E_[rdeid / 3 * 3 + (rdeid + 1) % 3];
+				if (e_bc == -1 || e_ad == -1
+					|| out_F_(deid / 3, (deid + 2) % 3)
+					== out_F_(rdeid / 3, (rdeid + 2) % 3))
+					continue;
+				int claims[4] = {deid / 3, rdeid / 3, e_bc / 3, e_ad / 3};
+				bool conflict = false;
+				for (int j = 0; j < 4; ++j) {
+					if (face_stamp[claims[j]] == round)
+						conflict = true;
 				}
-				if (E2E_[f * 3 + (j + 1) % 3] < prev_face_num * 3) {
-					E2E_[E2E_[f * 3 + (j + 1) % 3]] = (num_F_ - 1) * 3 + 1;
+				if (conflict) {
+					next_pending.push_back(pending[i]);
+					continue;
 				}
+				for (int j = 0; j < 4; ++j)
+					face_stamp[claims[j]] = round;
+				batch.push_back(pending[i]);
+				batch_dedges.push_back(deid);
+				batch_twins.push_back(rdeid);
 			}
-		}
 
-		// insert E2E and V2E
-		std::vector<int> update_face_set;
-		std::set<int> update_vertex_set;
-		update_face_set.reserve(face_splits.size() + num_F_ - prev_face_num);
-		while (V2E_.size() < num_V_) {
-			V2E_.conservativeResize(V2E_.size() * 2);
-		}
-		while (E2E_.size() < num_F_ * 3) {
-			E2E_.conservativeResize(E2E_.size() * 2);
-		}
-		for (auto& info : face_splits) {
-			auto f = out_F_.row(info.first);
-			update_face_set.push_back(info.first);
-			for (int i = 0; i < 3; ++i) {
-				int v0 = f[i];
-				int v1 = f[(i + 1) % 3];
-				int dedge = info.first * 3 + i;
-				V2E_[v0] = dedge;
-				if (v0 < prev_vertex_num)
-					update_vertex_set.insert(v0);
-				dedges[std::make_pair(v0, v1)] = dedge;
+			int num_batch = (int)batch.size();
+			ParallelFor(0, num_batch, [&](int i) {
+				int m = num_V_ + i;
+				int v0 = split_edges[batch[i]].first;
+				out_V_.row(m) = P.row(batch[i]);
+				out_N_.row(m) = out_N_.row(v0);
+				target_V_.row(m) = targetP.row(batch[i]);
+				sqrD_[m] = sqrD[batch[i]];
+				I_[m] = I[batch[i]];
+				sharp_vertices_[m] = sharp[batch[i]];
+				vertex_source_[m] = -1;
+				if (!frozen_.empty())
+					frozen_[m] = 0;
+				SplitEdge(batch_dedges[i], batch_twins[i], m,
+					num_F_ + i * 2, num_F_ + i * 2 + 1);
+			});
+			// a and b may have pointed at the outer edges that moved
+			for (int i = 0; i < num_batch; ++i) {
+				int m = num_V_ + i;
+				int f2 = num_F_ + i * 2;
+				int g2 = f2 + 1;
+				int v0 = split_edges[batch[i]].first;
+				int v1 = split_edges[batch[i]].second;
+				int deid = batch_dedges[i];
+				int rdeid = batch_twins[i];
+				V2E_[m] = f2 * 3;
+				if (V2E_[v1] == deid / 3 * 3 + (deid + 1) % 3)
+					V2E_[v1] = f2 * 3 + 1;
+				if (V2E_[v0] == rdeid / 3 * 3 + (rdeid + 1) % 3)
+					V2E_[v0] = g2 * 3 + 1;
+				if (deid / 3 < prev_face_num)
+					touched_faces.push_back(deid / 3);
+				if (rdeid / 3 < prev_face_num)
+					touched_faces.push_back(rdeid / 3);
 			}
+			num_V_ += num_batch;
+			num_F_ += num_batch * 2;
+			pending.swap(next_pending);
 		}
-		for (int k = prev_face_num; k < num_F_; ++k) {
-			auto f = out_F_.row(k);
-			update_face_set.push_back(k);
-			for (int i = 0; i < 3; ++i) {
-				int v0 = f[i];
-				int v1 = f[(i + 1) % 3];
-				int dedge = k * 3 + i;
-				V2E_[v0] = dedge;
-				if (v0 < prev_vertex_num)
-					update_vertex_set.insert(v0);
-				dedges[std::make_pair(v0, v1)] = dedge;
-			}
-		}
-		for (auto& info : dedges) {
-			int deid = info.second;
-			auto key = std::make_pair(info.first.second, info.first.first);
-			int rdeid = dedges[key];
-			E2E_[deid] = rdeid;
-			E2E_[rdeid] = deid;
-		}
+		std::sort(touched_faces.begin(), touched_faces.end());
+		touched_faces.erase(std::unique(touched_faces.begin(),
+			touched_faces.end()), touched_faces.end());
+		for (int k = prev_face_num; k < num_F_; ++k)
+			touched_faces.push_back(k);
 		//Sanity("After some operation...\n");
 
 		num_active_ = 0;
@@ -780,8 +1173,8 @@ void MeshProjector::AdaptiveRefine(FT len, FT ratio) {
 
 		// update candidates
 		candidates.clear();
-		for (auto& info : face_splits) {
-			auto f = out_F_.row(info.first);
+		for (auto& face : touched_faces) {
+			auto f = out_F_.row(face);
 			int masks[3] = {0,0,0};
 			for (int i = 0; i < 3; ++i) {
 				int v0 = f[i];
@@ -796,30 +1189,7 @@ void MeshProjector::AdaptiveRefine(FT len, FT ratio) {
 				if (masks[i] == 1 || masks[(i + 1) % 3] == 1)
 					continue;
 				if (v0 >= prev_vertex_num || v1 >= prev_vertex_num) {
-					int dedge = info.first * 3 + i;
-					if (E2E_[dedge] > dedge) {
-						candidates.push_back(dedge);
-					}
-				}
-			}
-		}
-		for (int k = prev_face_num; k < num_F_; ++k) {
-			auto f = out_F_.row(k);
-			int masks[3] = {0, 0, 0};
-			for (int i = 0; i < 3; ++i) {
-				int v0 = f[i];
-				FT dis = (out_V_.row(v0) - target_V_.row(v0)).norm();
-				if (v0 >= prev_vertex_num && dis > len * ratio) {
-					masks[i] = 1;
-				}
-			}
-			for (int i = 0; i < 3; ++i) {
-				int v0 = f[i];
-				int v1 = f[(i + 1) % 3];
-				if (masks[i] == 1 || masks[(i + 1) % 3] == 1)
-					continue;
-				if (v0 >= prev_vertex_num || v1 >= prev_vertex_num) {
-					int dedge = k * 3 + i;
+					int dedge = face * 3 + i;
 					if (E2E_[dedge] > dedge) {
 						candidates.push_back(dedge);
 					}
@@ -864,18 +1234,18 @@ bool MeshProjector::IsNeighbor(int v1, int v2) {
 }
 
 void MeshProjector::EdgeFlipRefine(std::vector<int>& candidates) {
-	std::unordered_map<int, int> dedge_to_index;
+	// dedge_index[e] is the candidate slot holding dedge e, or -1
+	std::vector<int> dedge_index(num_F_ * 3, -1);
 	for (int i = 0; i < candidates.size(); ++i) {
-		dedge_to_index[candidates[i]] = i;
+		dedge_index[candidates[i]] = i;
 	}
 
 	auto TestAndSwitch = [&](int dedge) {
-		auto it = dedge_to_index.find(dedge);
-		if (it != dedge_to_index.end()) {
-			int index = it->second;
-			dedge_to_index.erase(dedge);
-			if (dedge_to_index.count(E2E_[dedge]) == 0) {
-				dedge_to_index[E2E_[dedge]] = index;
+		int index = dedge_index[dedge];
+		if (index != -1) {
+			dedge_index[dedge] = -1;
+			if (dedge_index[E2E_[dedge]] == -1) {
+				dedge_index[E2E_[dedge]] = index;
 				candidates[index] = E2E_[dedge];
 			} else {
 				candidates[index] = -1;
@@ -887,77 +1257,134 @@ void MeshProjector::EdgeFlipRefine(std::vector<int>& candidates) {
 		E2E_[e2] = e1;
 	};
 
-	std::unordered_set<int> modified_faces;
+	// Every round evaluates all candidates, then flips the ones that win
+	// all four of their vertices. Flips on vertex-disjoint quads touch
+	// disjoint faces, twins and candidate slots, so winners run in
+	// parallel; the smallest flipping slot always wins, so rounds progress.
+	std::vector<char> modified_faces(num_F_, 0);
+	std::vector<std::atomic<int> > claims(num_V_);
+	std::vector<Vector4i> quads(candidates.size());
+	std::vector<int> flips, winners;
 	while (true) {
-		bool update = false;
-		for (int i = 0; i < candidates.size(); ++i) {
+		std::vector<char> flip(candidates.size(), 0);
+		ParallelFor(0, (int)candidates.size(), [&](int i) {
 			if (candidates[i] < 0)
-				continue;
+				return;
 			int deid = candidates[i];
 			int v0 = out_F_(deid / 3, deid % 3);
 			int v1 = out_F_(deid / 3, (deid + 1) % 3);
 			int v2 = out_F_(deid / 3, (deid + 2) % 3);
 			int rdeid = E2E_[deid];
 			int v3 = out_F_(rdeid / 3, (rdeid + 2) % 3);
-			if (IsNeighbor(v2, v3) || v2 == v3)
-				continue;
+			if (v2 == v3 || IsNeighbor(v2, v3))
+				return;
+			if (!frozen_.empty() && frozen_[v0] && frozen_[v1])
+				return;
 			if ((out_V_.row(v0)-out_V_.row(v1)).squaredNorm() >
 				(out_V_.row(v2)-out_V_.row(v3)).squaredNorm()) {
-				dedge_to_index.erase(deid);
-				int e1 = deid;
-				int e1_a = (e1 % 3 == 2) ? e1 - 2 : e1 + 1;
-				int e1_b = (e1 % 3 == 0) ? e1 + 2 : e1 - 1;
-				int e2 = E2E_[deid];
-				int e2_a = (e2 % 3 == 2) ? e2 - 2 : e2 + 1;
-				int e2_b = (e2 % 3 == 0) ? e2 + 2 : e2 - 1;
-				int e1_ar = E2E_[e1_a];
-				int e1_br = E2E_[e1_b];
-				int e2_ar = E2E_[e2_a];
-				int e2_br = E2E_[e2_b];
-				TestAndSwitch(e1_a);
-				TestAndSwitch(e1_b);
-				TestAndSwitch(e2_a);
-				TestAndSwitch(e2_b);
-				int f1 = e1 / 3;
-				int f2 = e2 / 3;
-				Vector3 d1 = out_V_.row(v3) - out_V_.row(v2);
-				Vector3 d2 = out_V_.row(v0) - out_V_.row(v2);
-				Vector3 d3 = out_V_.row(v1) - out_V_.row(v2);
-				Vector3 n1 = d2.cross(d1);
-				Vector3 n2 = d1.cross(d3);
-				if (n1.norm() > 0)
-					n1 = n1 / n1.norm();
-				if (n2.norm() > 0)
-					n2 = n2 / n2.norm();
-				out_F_.row(f1) = Vector3i(v0, v3, v2);
-				out_FN_.row(f1) = n1;
-				out_F_.row(f2) = Vector3i(v2, v3, v1);
-				out_FN_.row(f2) = n2;
-
-				modified_faces.insert(f1);
-				modified_faces.insert(f2);
-
-				V2E_[v0] = f1 * 3;
-				V2E_[v3] = f1 * 3 + 1;
-				V2E_[v2] = f1 * 3 + 2;
-				V2E_[v1] = f2 * 3 + 2;
-
-				PairDedge(e1_ar, f2 * 3 + 2);
-				PairDedge(e2_br, f2 * 3 + 1);
-				PairDedge(f1 * 3 + 1, f2 * 3);
-				PairDedge(e1_br, f1 * 3 + 2);
-				PairDedge(e2_ar, f1 * 3);
-				update = true;
-				
-				dedge_to_index[f1 * 3 + 2] = i;
-				candidates[i] = f1 * 3 + 2;
+				quads[i] = Vector4i(v0, v1, v2, v3);
+				flip[i] = 1;
 			}
+		});
+		flips.clear();
+		for (int i = 0; i < (int)flip.size(); ++i) {
+			if (flip[i])
+				flips.push_back(i);
 		}
-		if (!update)
+		if (flips.empty())
 			break;
+
+		ParallelFor(0, (int)flips.size(), [&](int k) {
+			for (int j = 0; j < 4; ++j)
+				claims[quads[flips[k]][j]].store(INT_MAX,
+					std::memory_order_relaxed);
+		});
+		ParallelFor(0, (int)flips.size(), [&](int k) {
+			int i = flips[k];
+			for (int j = 0; j < 4; ++j) {
+				std::atomic<int>& claim = claims[quads[i][j]];
+				int current = claim.load(std::memory_order_relaxed);
+				while (i < current && !claim.compare_exchange_weak(current, i,
+					std::memory_order_relaxed)) {
+				}
+			}
+		});
+		winners.clear();
+		for (auto& i : flips) {
+			bool win = true;
+			for (int j = 0; j < 4; ++j) {
+				if (claims[quads[i][j]].load(std::memory_order_relaxed) != i)
+					win = false;
+			}
+			if (win)
+				winners.push_back(i);
+		}
+
+		int num_fused = (int)fused_faces_.size();
+		fused_faces_.resize(num_fused + winners.size());
+		ParallelFor(0, (int)winners.size(), [&](int k) {
+			int i = winners[k];
+			int deid = candidates[i];
+			int v0 = quads[i][0];
+			int v1 = quads[i][1];
+			int v2 = quads[i][2];
+			int v3 = quads[i][3];
+			dedge_index[deid] = -1;
+			int e1 = deid;
+			int e1_a = (e1 % 3 == 2) ? e1 - 2 : e1 + 1;
+			int e1_b = (e1 % 3 == 0) ? e1 + 2 : e1 - 1;
+			int e2 = E2E_[deid];
+			int e2_a = (e2 % 3 == 2) ? e2 - 2 : e2 + 1;
+			int e2_b = (e2 % 3 == 0) ? e2 + 2 : e2 - 1;
+			int e1_ar = E2E_[e1_a];
+			int e1_br = E2E_[e1_b];
+			int e2_ar = E2E_[e2_a];
+			int e2_br = E2E_[e2_b];
+			TestAndSwitch(e1_a);
+			TestAndSwitch(e1_b);
+			TestAndSwitch(e2_a);
+			TestAndSwitch(e2_b);
+			int f1 = e1 / 3;
+			int f2 = e2 / 3;
+			fused_faces_[num_fused + k] = std::make_pair(face_source_[f1],
+				face_source_[f2]);
+			Vector3 d1 = out_V_.row(v3) - out_V_.row(v2);
+			Vector3 d2 = out_V_.row(v0) - out_V_.row(v2);
+			Vector3 d3 = out_V_.row(v1) - out_V_.row(v2);
+			Vector3 n1 = d2.cross(d1);
+			Vector3 n2 = d1.cross(d3);
+			if (n1.norm() > 0)
+				n1 = n1 / n1.norm();
+			if (n2.norm() > 0)
+				n2 = n2 / n2.norm();
+			out_F_.row(f1) = Vector3i(v0, v3, v2);
+			out_FN_.row(f1) = n1;
+			out_F_.row(f2) = Vector3i(v2, v3, v1);
+			out_FN_.row(f2) = n2;
+
+			modified_faces[f1] = 1;
+			modified_faces[f2] = 1;
+
+			V2E_[v0] = f1 * 3;
+			V2E_[v3] = f1 * 3 + 1;
+			V2E_[v2] = f1 * 3 + 2;
+			V2E_[v1] = f2 * 3 + 2;
+
+			PairDedge(e1_ar, f2 * 3 + 2);
+			PairDedge(e2_br, f2 * 3 + 1);
+			PairDedge(f1 * 3 + 1, f2 * 3);
+			PairDedge(e1_br, f1 * 3 + 2);
+			PairDedge(e2_ar, f1 * 3);
+			
+			dedge_index[f1 * 3 + 2] = i;
+			candidates[i] = f1 * 3 + 2;
+		});
 	}
-	std::unordered_map<int, int> faces_to_remove;
-	for (auto& f : modified_faces) {
+	// faces_to_remove[f] is the dedge whose collapse removes face f, or -1
+	std::vector<int> faces_to_remove(num_F_, -1);
+	for (int f = 0; f < num_F_; ++f) {
+		if (!modified_faces[f])
+			continue;
 		int to_modify = -1;
 		for (int j = 0; j < 3; ++j) {
 			int i = f * 3 + j;
@@ -973,17 +1400,17 @@ void MeshProjector::EdgeFlipRefine(std::vector<int>& candidates) {
 			faces_to_remove[E2E_[to_modify] / 3] = E2E_[to_modify];
 		} else {
 			for (int j = 0; j < 3; ++j) {
-				if (dedge_to_index.count(f * 3 + j) == 0 &&
-					dedge_to_index.count(E2E_[f * 3 + j]) == 0) {
-					dedge_to_index[f * 3 + j] = 1;
+				if (dedge_index[f * 3 + j] == -1 &&
+					dedge_index[E2E_[f * 3 + j]] == -1) {
+					dedge_index[f * 3 + j] = 1;
 				}
 			}
 		}
 	}
 
-	for (auto& f : faces_to_remove) {
-		int dedge = f.second;
-		if (out_F_(dedge/3, dedge%3) == -1)
+	for (int f = 0; f < num_F_; ++f) {
+		int dedge = faces_to_remove[f];
+		if (dedge == -1 || out_F_(dedge/3, dedge%3) == -1)
 			continue;
 		int e1 = dedge;
 		int e1_a = (e1 % 3 == 2) ? e1 - 2 : e1 + 1;
@@ -1000,6 +1427,13 @@ void MeshProjector::EdgeFlipRefine(std::vector<int>& candidates) {
 		TestAndSwitch(e1_b);
 		TestAndSwitch(e2_a);
 		TestAndSwitch(e2_b);
+		int neighbors[4] = {e1_ar / 3, e1_br / 3, e2_ar / 3, e2_br / 3};
+		fused_faces_.push_back(std::make_pair(face_source_[e1 / 3],
+			face_source_[e2 / 3]));
+		for (int j = 0; j < 4; ++j) {
+			fused_faces_.push_back(std::make_pair(face_source_[e1 / 3],
+				face_source_[neighbors[j]]));
+		}
 		PairDedge(e1_ar, e2_br);
 		PairDedge(e1_br, e2_ar);
 		E2E_[e1] = -1;
@@ -1021,29 +1455,26 @@ void MeshProjector::EdgeFlipRefine(std::vector<int>& candidates) {
 		V2E_[v1] = (out_F_(e2_br / 3, e2_br % 3) == -1) ? -1 : e2_br;
 	}
 
-	int top = 0;
-	candidates.resize(dedge_to_index.size());
-	for (auto& p : dedge_to_index) {
-		int deid = p.first;
-		if (dedge_to_index.count(E2E_[deid]) && E2E_[deid] < deid)
+	candidates.clear();
+	for (int deid = 0; deid < num_F_ * 3; ++deid) {
+		if (dedge_index[deid] == -1)
+			continue;
+		if (E2E_[deid] != -1 && dedge_index[E2E_[deid]] != -1 && E2E_[deid] < deid)
 			continue;
 		int v0 = out_F_(deid / 3, deid % 3);
 		if (v0 != -1) {
-			candidates[top++] = deid;
+			candidates.push_back(deid);
 		}
 	}
 	//printf("%d to %d\n", candidates.size(), top);
-	candidates.resize(top);
 	//Sanity("EdgeFlip");
 }
 
 void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug) {
-	std::vector<Vector3> A;
-	std::vector<FT> B;
-	int deid = V2E_[v];
-	int deid0 = deid;
+	static thread_local ConstraintSet A;
+	A.clear();
 
-	do {
+	ForEachRingEdge(v, [&](int deid) {
 		int v0 = out_F_(deid / 3, deid % 3);
 		int v1 = out_F_(deid / 3, (deid + 1) % 3);
 		int v2 = out_F_(deid / 3, (deid + 2) % 3);
@@ -1056,16 +1487,13 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 			
 			//b -= len * 0.05;
 
-			A.push_back(d);
-			B.push_back(b);
+			A.push_back(d, b);
 
 		}
-		deid = E2E_[deid / 3 * 3 + (deid + 2) % 3];
-	} while (deid0 != deid);
+	});
 
-	std::vector<int> attached_dimensions(A.size(), 0);
-	std::vector<Vector3> constraints;
-	constraints.reserve(3);
+	Vector3 constraints[3];
+	int constraint_count = 0;
 	
 	for (int i = 0; i < A.size(); ++i) {
 		Vector3 offset = p - Vector3(out_V_.row(v));
@@ -1077,7 +1505,7 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 		Vector3 tar_dir = offset / tar_step;
 
 #ifdef PROJ_THREE_TIMES
-		if (constraints.size() == 1) {
+		if (constraint_count == 1) {
 			tar_dir = tar_dir - tar_dir.dot(constraints[0]) * constraints[0];
 			FT n = tar_dir.norm();
 			if (n < ZERO_THRES)
@@ -1085,7 +1513,7 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 			tar_step *= n;
 			tar_dir /= n;
 		} 
-		else if (constraints.size() == 2) {
+		else if (constraint_count == 2) {
 			Vector3 dir = constraints[0].cross(constraints[1]).normalized();
 			tar_dir = tar_dir.dot(dir) * dir;
 			FT n = tar_dir.norm();
@@ -1094,12 +1522,12 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 			tar_step *= n;
 			tar_dir /= n;			
 		}
-		else if (constraints.size() == 3) {
+		else if (constraint_count == 3) {
 			return;
 		}
 #else
-		if (constraints.size() > 0) {
-			Vector3 c = constraints.back();
+		if (constraint_count > 0) {
+			Vector3 c = constraints[constraint_count - 1];
 			Vector3 temp_dir = tar_dir - tar_dir.dot(c) * c;
 			FT n = temp_dir.norm();
 			if (n < ZERO_THRES)
@@ -1107,7 +1535,7 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 			temp_dir /= n;
 			int boundary_constraint = 0;
 			Vector3 temp_boundary[3];
-			for (int j = 0; j < constraints.size(); ++j) {
+			for (int j = 0; j < constraint_count; ++j) {
 				FT denominator = constraints[j].dot(temp_dir);
 				if (denominator > -1e-3) {
 					temp_boundary[boundary_constraint] = constraints[j];
@@ -1126,7 +1554,7 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 					return;
 				temp_dir /= n;
 				boundary_constraint = 0;
-				for (int j = 0; j < constraints.size(); ++j) {
+				for (int j = 0; j < constraint_count; ++j) {
 					FT denominator = constraints[j].dot(temp_dir);
 					if (denominator > -1e-3)
 						boundary_constraint += 1;
@@ -1136,13 +1564,13 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 			}
 
 			int top = 0;
-			for (int j = 0; j < constraints.size(); ++j) {
+			for (int j = 0; j < constraint_count; ++j) {
 				FT denominator = constraints[j].dot(temp_dir);
 				if (denominator > -1e-3) {
 					constraints[top++] = constraints[j];
 				}
 			}
-			constraints.resize(top);
+			constraint_count = top;
 			if (top == 3) {
 				return;
 			}
@@ -1164,12 +1592,12 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 		FT max_step = tar_step;
 		int constraint_id = -1;
 		for (int j = 0; j < A.size(); ++j) {
-			if (attached_dimensions[j])
+			if (A.attached[j])
 				continue;
-			FT denominator = A[j].dot(tar_dir);
+			FT denominator = A.dot(j, tar_dir);
 			if (denominator < ZERO_THRES)
 				continue;
-			FT step = B[j] / denominator;
+			FT step = A.b[j] / denominator;
 			if (step < max_step) {
 				constraint_id = j;
 				max_step = step;
@@ -1184,33 +1612,33 @@ void MeshProjector::OptimizePosition(int v, const Vector3& p, FT len, bool debug
 		if (max_step == tar_step)
 			return;
 
-		int constraint_size = constraints.size();
+		int constraint_size = constraint_count;
 		int new_element = 0;
 		for (int j = 0; j < A.size(); ++j) {
-			if (attached_dimensions[j])
+			if (A.attached[j])
 				continue;
-			FT denominator = A[j].dot(tar_dir);
-			B[j] -= denominator * max_step;
+			FT denominator = A.dot(j, tar_dir);
+			A.b[j] -= denominator * max_step;
 
-			if (B[j] < ZERO_THRES && denominator >= ZERO_THRES) {
+			if (A.b[j] < ZERO_THRES && denominator >= ZERO_THRES) {
 				bool linear_dependent = false;
 				if (constraint_size == 1
-					&& constraints[0].cross(A[j]).norm() < ZERO_THRES)
+					&& constraints[0].cross(A.row(j)).norm() < ZERO_THRES)
 					linear_dependent = true;
 				if (constraint_size == 2) {
 					Vector3 n = constraints[0].cross(constraints[1]);
-					if (std::abs(n.normalized().dot(A[j])) < ZERO_THRES) {
+					if (std::abs(n.normalized().dot(A.row(j))) < ZERO_THRES) {
 						linear_dependent = true;
 					}
 				} 
 				if (!linear_dependent) {
 					if (new_element == 0) {
-						constraints.push_back(A[j]);
+						constraints[constraint_count++] = A.row(j);
 						new_element = 1;
-						attached_dimensions[j] = 1;
+						A.attached[j] = 1;
 					}
 				} else {
-					attached_dimensions[j] = 1;
+					A.attached[j] = 1;
 				}
 			}
 		}
@@ -1221,9 +1649,7 @@ void MeshProjector::OptimizeNormal(int i, const Vector3& vn,
 	const Vector3& target_vn) {
 	Vector3 d = target_vn - vn;
 	FT max_step = 1.0;
-	int deid = V2E_[i];
-	int deid0 = deid;
-	do {
+	ForEachRingEdge(i, [&](int deid) {
 		Vector3 fn = out_FN_.row(deid / 3);
 		FT denominator = d.dot(fn);
 		if (denominator < -ZERO_THRES) {
@@ -1232,8 +1658,7 @@ void MeshProjector::OptimizeNormal(int i, const Vector3& vn,
 				max_step = step;
 			}
 		}
-		deid = E2E_[deid / 3 * 3 + (deid + 2) % 3];
-	} while (deid0 != deid);
+	});
 	if (max_step < 0) {
 		max_step = 0;
 	}
@@ -1243,7 +1668,7 @@ void MeshProjector::OptimizeNormal(int i, const Vector3& vn,
 void MeshProjector::OptimizeNormals() {
 	MatrixD prev_norm = out_N_;
 	UpdateVertexNormals(0);
-	igl::per_face_normals(out_V_, out_F_, out_FN_);
+	UpdateFaceNormals();
 	for (int i = 0; i < num_V_; ++i) {
 		Vector3 vn = prev_norm.row(i);
 		Vector3 target_vn = out_N_.row(i);
@@ -1316,8 +1741,7 @@ void MeshProjector::PreserveSharpFeatures(FT len_thres) {
 	MatrixD tarP;
 	*/
 	UpdateNearestDistance();
-	MatrixD origin_FN;
-	igl::per_face_normals(V_, F_, origin_FN);
+	const MatrixD& origin_FN = FN_;
 	auto consistent = [&](int src_f0, int src_f1) {
 		if (src_f0 == src_f1)
 			return true;
@@ -1,24 +1,125 @@
 #ifndef MANIFOLD2_MESH_PROJECTOR_H_
 #define MANIFOLD2_MESH_PROJECTOR_H_
 
+#include <chrono>
+#include <utility>
 #include <vector>
 #include <igl/AABB.h>
 
+#include "Progress.h"
 #include "types.h"
 
+// Stopping criteria for IterativeOptimize. Distances are in units of the
+// grid edge length; a non-positive value disables the criterion.
+// max_seconds counts from the start of Project, max_iterations and
+// max_visit_ratio apply to each Gauss-Seidel pass.
+struct ProjectorOptions
+{
+	ProjectorOptions()
+	: ring_cache(true), reorder(true), stable_order(false),
+	  max_seconds(0), max_iterations(0), max_visit_ratio(5),
+	  target_max_distance(0), target_mean_distance(0), min_improvement(0),
+	  trace(false), seed(0)
+	{}
+	// Gather vertex one-rings into CSR arrays before each Gauss-Seidel
+	// pass instead of walking E2E_ on every visit.
+	bool ring_cache;
+	// Renumber the input vertices along a Morton curve (and faces after
+	// them) before projection so neighbors are close in memory.
+	bool reorder;
+	// Undo the reordering on output: input vertices and faces keep their
+	// order and new ones follow.
+	bool stable_order;
+
+	double max_seconds;
+	int max_iterations;
+	// stop after this many vertex updates per output vertex
+	double max_visit_ratio;
+	FT target_max_distance;
+	FT target_mean_distance;
+	// stop once no vertex got this much closer to its target in an iteration
+	FT min_improvement;
+	// print a line per iteration; the stats are kept either way
+	bool trace;
+	// Seeds the shuffle of the independent vertex sets. Together with the
+	// order-preserving parallel loops this makes the output a function of
+	// the input and options only, whatever the thread count.
+	unsigned int seed;
+};
+
+struct ProjectorIterationStats
+{
+	int iteration;
+	int num_active;
+	FT max_change;
+	FT max_distance;
+	FT mean_distance;
+	double seconds;
+};
+
 class MeshProjector
 {
 public:
 	MeshProjector();
-	void ComputeHalfEdge();
+	void SetOptions(const ProjectorOptions& options);
+	// Reports each phase of Project to progress (not owned, may be null)
+	// and stops when it is cancelled.
+	void SetProgress(Progress* progress) { progress_ = progress; }
+	// Per-iteration statistics of every Gauss-Seidel pass in the last
+	// Project call. Distances are only filled in when a distance target
+	// or trace is set, and are in units of the grid edge length.
+	const std::vector<ProjectorIterationStats>& Trace() const {
+		return trace_;
+	}
+	// Builds the AABB tree over the target mesh. Project builds it on first
+	// use; calling this up front lets one projector serve several outputs.
+	void InitTree(const MatrixD& V, const MatrixI& F);
+	void SquaredDistance(const MatrixD& P, VectorX* sqrD, VectorXi* I,
+		MatrixD* C) const;
+	// Bytes of the AABB tree with its copy of the target mesh, and of the
+	// per-element arrays of the last Project call.
+	size_t TreeBytes() const;
+	size_t MemoryBytes() const;
+	// False (after logging why) when the DEBUG_ consistency checks fail.
+	bool ComputeHalfEdge();
 	void ComputeIndependentSet();
+	// Recomputes the normals of the faces around vertex i after it moved.
 	void UpdateFaceNormal(int i);
+	// Computes all output face normals in parallel unless they are already
+	// current; moves keep them current through UpdateFaceNormal.
+	void UpdateFaceNormals();
 	void UpdateVertexNormal(int i, int conservative);
 	void UpdateVertexNormals(int conservative);
 	void IterativeOptimize(FT len, bool initialized = false);
 	void AdaptiveRefine(FT len, FT ratio = 0.1);
+	void ReserveElements(int num_V, int num_F);
 	void EdgeFlipRefine(std::vector<int>& candidates);
-	void Project(const MatrixD& V, const MatrixI& F,
+	// Uses a projected coarser-level mesh as the initial guess for the
+	// next Project call: every output vertex first moves toward its
+	// closest point on that mesh, under the usual no-flip constraints.
+	void SetWarmStart(const MatrixD& coarse_V, const MatrixI& coarse_F);
+	// Vertices with a nonzero entry, indexed like the out_V of the next
+	// Project call, keep their position: they are never optimized and
+	// refinement only touches edges with a free end, so faces with three
+	// frozen corners reach the output unchanged. Project clears the mask.
+	void SetFrozen(const std::vector<char>& frozen);
+	// Grid edge length for the next Project call, which otherwise measures
+	// the first edge of its out_F.
+	void SetEdgeLength(FT len) { edge_length_ = len; }
+	// Where the output of the last Project call came from: the out_V row
+	// each output vertex started as (-1 for vertices added by refinement)
+	// and the out_F row each output face was cut from.
+	const std::vector<int>& VertexSource() const { return vertex_source_; }
+	const std::vector<int>& FaceSource() const { return face_source_; }
+	// Pairs of out_F rows whose output faces were rebuilt together: the
+	// two sides of an edge flip, and the faces removed by a collapse with
+	// their neighbors.
+	const std::vector<std::pair<int, int> >& FusedFaces() const {
+		return fused_faces_;
+	}
+	// Returns false, with out_V and out_F emptied, when cancelled or when
+	// a consistency check fails.
+	bool Project(const MatrixD& V, const MatrixI& F,
 		MatrixD* out_V, MatrixI* out_F);
 	void UpdateNearestDistance();
 	int BoundaryCheck();
@@ -28,16 +129,46 @@ public:
 	void OptimizeNormals();
 	void PreserveSharpFeatures(FT len_thres);
 	void Highlight(int id, FT len);
-	void Sanity(const char* log);
+	// Logs the first broken half-edge invariant and returns false.
+	bool Sanity(const char* log);
 
 	bool IsNeighbor(int v1, int v2);
+	void BuildRings();
 private:
+	// Calls func(deid) for each half-edge leaving v, in E2E_ walk order.
+	template <class Func>
+	void ForEachRingEdge(int v, const Func& func) const {
+		if (ring_ready_) {
+			for (int r = ring_offset_[v]; r < ring_offset_[v + 1]; ++r)
+				func(ring_[r]);
+			return;
+		}
+		int deid = V2E_[v];
+		int deid0 = deid;
+		do {
+			func(deid);
+			deid = E2E_[deid / 3 * 3 + (deid + 2) % 3];
+		} while (deid0 != deid);
+	}
+
+	ProjectorOptions options_;
+	Progress* progress_;
+	std::chrono::steady_clock::time_point start_;
+	std::vector<ProjectorIterationStats> trace_;
 	std::vector<std::vector<int> > vertex_groups_;
 
 	igl::AABB<MatrixD,3> tree_;
+	bool tree_ready_;
 	MatrixD V_, out_V_, target_V_, out_N_, out_FN_;
+	// face normals of the target mesh, computed once by InitTree
+	MatrixD FN_;
+	bool face_normals_ready_;
 	MatrixI F_, out_F_;
+	MatrixD warm_V_;
+	MatrixI warm_F_;
 	VectorXi V2E_, E2E_;
+	std::vector<int> ring_offset_, ring_;
+	bool ring_ready_;
 
 	VectorX sqrD_;
 	VectorXi I_;
@@ -46,9 +177,33 @@ private:
 	std::vector<Vector3> sharp_positions_;
 
 	int num_V_, num_F_;
+	FT edge_length_;
+
+	// Per row of out_V_/out_F_ while projecting; the sources are per
+	// output row once Project returns, and the mask is cleared.
+	std::vector<char> frozen_;
+	std::vector<int> vertex_source_, face_source_;
+	std::vector<std::pair<int, int> > fused_faces_;
+
+	// Orders active_vertices_ into indices_ by descending sqrD_ using
+	// log-scale buckets; ties keep their order in the active set.
+	void ScheduleActive();
+	void WarmStart(FT len);
+	// Appends v to active_vertices_ once per activation generation;
+	// frozen vertices are never active.
+	void Activate(int v) {
+		if (!frozen_.empty() && frozen_[v])
+			return;
+		if (active_stamp_[v] != active_generation_) {
+			active_stamp_[v] = active_generation_;
+			active_vertices_[num_active_++] = v;
+		}
+	}
 
 	std::vector<int> active_vertices_, active_vertices_temp_;
-	std::vector<std::pair<FT, int> > indices_;
+	std::vector<int> indices_;
+	std::vector<int> active_stamp_, bucket_offset_, bucket_index_;
+	int active_generation_;
 	int num_active_;
 };
 #endif
\ No newline at end of file
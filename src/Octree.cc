@@ -1,6 +1,10 @@
 #include "Octree.h"
 
+#include <algorithm>
+
 #include "Intersection.h"
+#include "Parallel.h"
+#include "VoxelBitmap.h"
 
 Octree::Octree()
 {
@@ -87,25 +91,95 @@ bool Octree::IsExterior(const Vector3& p)
 	return children_[index]->IsExterior(p);
 }
 
-bool Octree::Intersection(int Find_ex, const Vector3& min_corner,
-	const Vector3& size, const MatrixD& V)
+size_t Octree::MemoryBytes() const
+{
+	size_t bytes = sizeof(Octree) + F_.capacity() * sizeof(Vector3i)
+		+ Find_.capacity() * sizeof(int)
+		+ empty_neighbors_.size() * (sizeof(Octree*) + 2 * sizeof(void*));
+	for (int i = 0; i < 8; ++i)
+	{
+		if (children_[i])
+			bytes += children_[i]->MemoryBytes();
+	}
+	return bytes;
+}
+
+// SAT test shared by Split and Build, so that both classify a triangle
+// against a cell identically. The vertices are moved to the cell center in
+// double before rounding to float, so large coordinates keep their
+// precision. The float test then runs on the cell grown and shrunk by a
+// margin that covers its rounding; only triangles that touch the cell
+// within that margin, where the two answers differ, reach the exact test.
+static bool TriangleCellOverlap(const MatrixD& V, const Vector3i& f,
+	const Vector3& min_corner, const Vector3& size)
 {
-	float boxcenter[3];
+	float boxcenter[3] = {0, 0, 0};
 	float boxhalfsize[3];
 	float triverts[3][3];
+	double center[3];
+	double extent = 0;
 	for (int i = 0; i < 3; ++i)
 	{
-		boxhalfsize[i] = size[i] * 0.5;
-		boxcenter[i] = min_corner[i] + boxhalfsize[i];
+		center[i] = min_corner[i] + size[i] * 0.5;
+		extent = std::max(extent, size[i] * 0.5);
 	}
 	for (int i = 0; i < 3; ++i)
 	{
 		for (int j = 0; j < 3; ++j)
 		{
-			triverts[i][j] = V(F_[Find_ex][i],j);
+			double d = V(f[i],j) - center[j];
+			triverts[i][j] = d;
+			extent = std::max(extent, std::abs(d));
+		}
+	}
+	// a few hundred float ulps of the largest magnitude in the test
+	float margin = extent * (1.0 / (1 << 15));
+	for (int i = 0; i < 3; ++i)
+		boxhalfsize[i] = size[i] * 0.5 + margin;
+	if (!TriBoxOverlap(boxcenter, boxhalfsize, triverts))
+		return false;
+	for (int i = 0; i < 3; ++i)
+		boxhalfsize[i] = size[i] * 0.5 - margin;
+	if (boxhalfsize[0] > 0 && boxhalfsize[1] > 0 && boxhalfsize[2] > 0
+		&& TriBoxOverlap(boxcenter, boxhalfsize, triverts))
+		return true;
+
+	double boxmin[3], boxmax[3], exact[3][3];
+	for (int i = 0; i < 3; ++i)
+	{
+		boxmin[i] = min_corner[i];
+		boxmax[i] = min_corner[i] + size[i];
+		for (int j = 0; j < 3; ++j)
+			exact[i][j] = V(f[i],j);
+	}
+	return TriBoxOverlapExact(boxmin, boxmax, exact);
+}
+
+bool Octree::Intersection(int Find_ex, const Vector3& min_corner,
+	const Vector3& size, const MatrixD& V)
+{
+	return TriangleCellOverlap(V, F_[Find_ex], min_corner, size);
+}
+
+void Octree::CreateChildren()
+{
+	Vector3 halfsize = volume_size_ * 0.5;
+	for (int i = 0; i < 2; ++i) {
+		for (int j = 0; j < 2; ++j) {
+			for (int k = 0; k < 2; ++k) {
+				int ind = i * 4 + j * 2 + k;
+
+				Vector3 startpoint = min_corner_;
+				startpoint[0] += i * halfsize[0];
+				startpoint[1] += j * halfsize[1];
+				startpoint[2] += k * halfsize[2];
+
+				children_[ind] = new Octree(startpoint, halfsize);
+				children_[ind]->occupied_ = 0;
+				children_[ind]->number_ = 0;
+			}
 		}
 	}
-	return TriBoxOverlap(boxcenter, boxhalfsize, triverts);
 }
 
 void Octree::Split(const MatrixD& V)
@@ -113,54 +187,201 @@ void Octree::Split(const MatrixD& V)
 	level_ += 1;
 	number_ = 0;
 	if (level_ > 1) {
-		for (int i = 0; i < 2; ++i) {
-			for (int j = 0; j < 2; ++j) {
-				for (int k = 0; k < 2; ++k) {
-					int ind = i * 4 + j * 2 + k;
-					if (children_[ind] && children_[ind]->occupied_) {
-						children_[ind]->Split(V);
-						number_ += children_[ind]->number_;
-					}
-				}
-			}
+		auto SplitChild = [&](int ind) {
+			if (children_[ind] && children_[ind]->occupied_)
+				children_[ind]->Split(V);
+		};
+		// Subtrees are independent. Only fan out where a child still
+		// covers a few levels of work; nested loops share the pool.
+		if (level_ > 3) {
+			ParallelFor(0, 8, SplitChild);
+		} else {
+			for (int ind = 0; ind < 8; ++ind)
+				SplitChild(ind);
+		}
+		for (int ind = 0; ind < 8; ++ind) {
+			if (children_[ind] && children_[ind]->occupied_)
+				number_ += children_[ind]->number_;
 		}
 		F_.clear();
 		Find_.clear();
 		return;
 	}
-	Vector3 halfsize = volume_size_ * 0.5;
+	CreateChildren();
+	for (int ind = 0; ind < 8; ++ind) {
+		Octree* child = children_[ind];
+		for (int face = 0; face < (int)F_.size(); ++face) {
+			if (Intersection(face, child->min_corner_, child->volume_size_, V)) {
+				child->F_.push_back(F_[face]);
+				child->Find_.push_back(Find_[face]);
+				if (child->occupied_ == 0) {
+					child->occupied_ = 1;
+					number_ += 1;
+					child->number_ = 1;
+				}
+			}
+		}
+	}
+	F_.clear();
+	Find_.clear();
+}
+
+struct CellFace {
+	unsigned long long key;
+	int face;
+};
+
+// Appends the finest cells below the cell (min_corner, size) that triangle
+// f overlaps, visiting children in Split's order and running the same
+// tests. Children clearly outside the triangle's bounding box are skipped;
+// margin keeps the skip conservative against the float test's rounding.
+static void BinTriangle(const MatrixD& V, const Vector3i& f, int face,
+	const Vector3& tri_min, const Vector3& tri_max, FT margin,
+	const Vector3& min_corner, const Vector3& size, int levels,
+	unsigned long long key, std::vector<CellFace>* pairs)
+{
+	if (levels == 0) {
+		CellFace pair;
+		pair.key = key;
+		pair.face = face;
+		pairs->push_back(pair);
+		return;
+	}
+	Vector3 halfsize = size * 0.5;
 	for (int i = 0; i < 2; ++i) {
 		for (int j = 0; j < 2; ++j) {
 			for (int k = 0; k < 2; ++k) {
 				int ind = i * 4 + j * 2 + k;
-
-				Vector3 startpoint = min_corner_;
+				Vector3 startpoint = min_corner;
 				startpoint[0] += i * halfsize[0];
 				startpoint[1] += j * halfsize[1];
 				startpoint[2] += k * halfsize[2];
-									
-				children_[ind] = new Octree(startpoint, halfsize);
-				children_[ind]->occupied_ = 0;
-				children_[ind]->number_ = 0;
 
-				for (int face = 0; face < (int)F_.size(); ++face) {
-					if (Intersection(face, startpoint, halfsize, V)) {
-						children_[ind]->F_.push_back(F_[face]);
-						children_[ind]->Find_.push_back(Find_[face]);
-						if (children_[ind]->occupied_ == 0) {
-							children_[ind]->occupied_ = 1;
-							number_ += 1;
-							children_[ind]->number_ = 1;
-						}
-					}
+				bool outside = false;
+				for (int d = 0; d < 3; ++d) {
+					if (tri_max[d] < startpoint[d] - margin
+						|| tri_min[d] > startpoint[d] + halfsize[d] + margin)
+						outside = true;
 				}
+				if (outside || !TriangleCellOverlap(V, f, startpoint, halfsize))
+					continue;
+				BinTriangle(V, f, face, tri_min, tri_max, margin, startpoint,
+					halfsize, levels - 1, (key << 3) | ind, pairs);
 			}
 		}
 	}
+}
+
+// Stable LSD radix sort on the low bits of key.
+static void RadixSortCells(std::vector<CellFace>* pairs, int bits)
+{
+	std::vector<CellFace> buffer(pairs->size());
+	for (int shift = 0; shift < bits; shift += 8) {
+		int count[257] = {0};
+		for (auto& p : *pairs)
+			count[((p.key >> shift) & 255) + 1] += 1;
+		for (int i = 0; i < 256; ++i)
+			count[i + 1] += count[i];
+		for (auto& p : *pairs)
+			buffer[count[(p.key >> shift) & 255]++] = p;
+		pairs->swap(buffer);
+	}
+}
+
+// Sets level_ and number_ the way depth calls of Split would have.
+static void FinishBuild(Octree* node, int height)
+{
+	if (!node->occupied_) {
+		node->level_ = 0;
+		node->number_ = 0;
+		return;
+	}
+	node->level_ = height;
+	if (height == 0) {
+		node->number_ = 1;
+		return;
+	}
+	node->number_ = 0;
+	for (int i = 0; i < 8; ++i) {
+		FinishBuild(node->children_[i], height - 1);
+		node->number_ += node->children_[i]->number_;
+	}
+}
+
+void Octree::Build(const MatrixD& V, int depth)
+{
+	if (depth <= 0)
+		return;
+	if (level_ != 0 || children_[0] || depth > 21) {
+		// only a fresh root fits, and cell keys hold 21 levels
+		for (int i = 0; i < depth; ++i)
+			Split(V);
+		return;
+	}
+
+	// Bin fixed chunks of triangles into their own buffers; joining them
+	// in chunk order keeps each cell's triangles in input order.
+	const int kChunk = 1024;
+	int num_faces = (int)F_.size();
+	int num_chunks = (num_faces + kChunk - 1) / kChunk;
+	std::vector<std::vector<CellFace> > chunk_pairs(num_chunks);
+	FT scale = std::max(min_corner_.cwiseAbs().maxCoeff(),
+		(min_corner_ + volume_size_).cwiseAbs().maxCoeff());
+	FT margin = volume_size_[0] * 1e-3 / (1 << depth) + scale * 1e-6;
+	ParallelFor(0, num_chunks, [&](int c) {
+		int end = std::min(num_faces, (c + 1) * kChunk);
+		for (int face = c * kChunk; face < end; ++face) {
+			const Vector3i& f = F_[face];
+			Vector3 tri_min = V.row(f[0]);
+			Vector3 tri_max = tri_min;
+			for (int j = 1; j < 3; ++j) {
+				tri_min = tri_min.cwiseMin(Vector3(V.row(f[j])));
+				tri_max = tri_max.cwiseMax(Vector3(V.row(f[j])));
+			}
+			BinTriangle(V, f, face, tri_min, tri_max, margin, min_corner_,
+				volume_size_, depth, 0, &chunk_pairs[c]);
+		}
+	});
+	std::vector<CellFace> pairs;
+	for (auto& chunk : chunk_pairs)
+		pairs.insert(pairs.end(), chunk.begin(), chunk.end());
+	std::vector<std::vector<CellFace> >().swap(chunk_pairs);
+	RadixSortCells(&pairs, depth * 3);
+
+	for (int start = 0; start < (int)pairs.size(); ) {
+		unsigned long long key = pairs[start].key;
+		Octree* node = this;
+		for (int t = depth - 1; t >= 0; --t) {
+			if (!node->children_[0])
+				node->CreateChildren();
+			node = node->children_[(key >> (3 * t)) & 7];
+			node->occupied_ = 1;
+		}
+		for (; start < (int)pairs.size() && pairs[start].key == key; ++start) {
+			node->F_.push_back(F_[pairs[start].face]);
+			node->Find_.push_back(Find_[pairs[start].face]);
+		}
+	}
+	if (!children_[0])
+		CreateChildren();
+	FinishBuild(this, depth);
 	F_.clear();
 	Find_.clear();
 }
 
+void Octree::ClearConnection()
+{
+	memset(connection_, 0, sizeof(Octree*) * 6);
+	memset(empty_connection_, 0, sizeof(Octree*) * 6);
+	empty_neighbors_.clear();
+	exterior_ = 0;
+	for (int i = 0; i < 8; ++i)
+	{
+		if (children_[i])
+			children_[i]->ClearConnection();
+	}
+}
+
 void Octree::BuildConnection()
 {
 	if (level_ == 0)
@@ -392,7 +613,7 @@ void Octree::BuildEmptyConnection()
 	}
 }
 
-void Octree::ConstructFace(const Vector3i& start,
+void Octree::ConstructFace(const Vector3i& start, const VoxelBitmap& bitmap,
 	std::map<GridIndex,int>* vcolor,
 	std::vector<Vector3>* vertices,
 	std::vector<Vector4i>* faces,
@@ -409,10 +630,12 @@ void Octree::ConstructFace(const Vector3i& start,
 			{Vector3i(0,0,0),Vector3i(0,1,0),Vector3i(0,1,1),Vector3i(0,0,1)},
 			{Vector3i(0,0,0),Vector3i(0,0,1),Vector3i(1,0,1),Vector3i(1,0,0)},
 			{Vector3i(0,0,0),Vector3i(1,0,0),Vector3i(1,1,0),Vector3i(0,1,0)}};
+		Vector3i dir[6] = {Vector3i(1,0,0), Vector3i(0,1,0), Vector3i(0,0,1),
+			Vector3i(-1,0,0), Vector3i(0,-1,0), Vector3i(0,0,-1)};
 
 		for (int i = 0; i < 6; ++i)
 		{
-			if (empty_connection_[i] && empty_connection_[i]->exterior_)
+			if (bitmap.Exterior(start + dir[i]))
 			{
 				int id[4];
 				for (int j = 0; j < 4; ++j)
@@ -454,9 +677,159 @@ void Octree::ConstructFace(const Vector3i& start,
 				int y = (i - x * 4) / 2;
 				int z = i - x * 4 - y * 2; 
 				Vector3i nstart = start * 2 + Vector3i(x,y,z);
-				children_[i]->ConstructFace(nstart, vcolor,
+				children_[i]->ConstructFace(nstart, bitmap, vcolor,
 					vertices, faces, v_faces);
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+struct FaceBuffer
+{
+	std::map<GridIndex,int> vcolor;
+	std::vector<Vector3> vertices;
+	std::vector<Vector4i> faces;
+	std::vector<std::set<int> > v_faces;
+	std::vector<GridIndex> keys;
+	std::vector<char> shared;
+	std::vector<int> global;
+};
+
+static void CollectSubtrees(Octree* tree, const Vector3i& start, int depth,
+	std::vector<std::pair<Octree*, Vector3i> >* subtrees)
+{
+	if (depth == 0 || tree->level_ == 0)
+	{
+		subtrees->push_back(std::make_pair(tree, start));
+		return;
+	}
+	for (int i = 0; i < 8; ++i)
+	{
+		if (tree->children_[i] && tree->children_[i]->occupied_)
+		{
+			int x = i / 4;
+			int y = (i - x * 4) / 2;
+			int z = i - x * 4 - y * 2;
+			CollectSubtrees(tree->children_[i], start * 2 + Vector3i(x,y,z),
+				depth - 1, subtrees);
+		}
+	}
+}
+
+void Octree::ConstructFaceParallel(const VoxelBitmap& bitmap,
+	std::map<GridIndex,int>* vcolor,
+	std::vector<Vector3>* vertices,
+	std::vector<Vector4i>* faces,
+	std::vector<std::set<int> >* v_faces)
+{
+	std::vector<std::pair<Octree*, Vector3i> > subtrees;
+	CollectSubtrees(this, Vector3i(0,0,0), 3, &subtrees);
+	int num_subtrees = (int)subtrees.size();
+	std::vector<FaceBuffer> buffers(num_subtrees);
+	ParallelFor(0, num_subtrees, [&](int t) {
+		FaceBuffer& buffer = buffers[t];
+		Octree* tree = subtrees[t].first;
+		tree->ConstructFace(subtrees[t].second, bitmap, &buffer.vcolor,
+			&buffer.vertices, &buffer.faces, &buffer.v_faces);
+		int num = (int)buffer.vertices.size();
+		buffer.keys.resize(num);
+		for (auto& info : buffer.vcolor)
+			buffer.keys[info.second] = info.first;
+		buffer.vcolor.clear();
+		// grid indices are doubled leaf coordinates
+		Vector3i lo = subtrees[t].second * (2 << tree->level_);
+		Vector3i hi = lo + Vector3i(1,1,1) * (2 << tree->level_);
+		buffer.shared.resize(num);
+		for (int i = 0; i < num; ++i)
+		{
+			const Vector3i& id = buffer.keys[i].id;
+			buffer.shared[i] = (id.array() == lo.array()).any()
+				|| (id.array() == hi.array()).any();
+		}
+		buffer.global.assign(num, -1);
+	});
+
+	// Boundary vertices belong to the first subtree that emits them, which
+	// is also where the serial traversal meets them first.
+	std::map<GridIndex, std::pair<int,int> > owners;
+	std::vector<int> vertex_offset(num_subtrees + 1, 0);
+	std::vector<int> face_offset(num_subtrees + 1, 0);
+	for (int t = 0; t < num_subtrees; ++t)
+	{
+		FaceBuffer& buffer = buffers[t];
+		int owned = 0;
+		for (int i = 0; i < (int)buffer.keys.size(); ++i)
+		{
+			if (buffer.shared[i])
+			{
+				auto it = owners.insert(std::make_pair(buffer.keys[i],
+					std::make_pair(t, i)));
+				if (!it.second)
+					continue;
+				buffer.shared[i] = 0;
+			}
+			owned += 1;
+		}
+		vertex_offset[t + 1] = vertex_offset[t] + owned;
+		face_offset[t + 1] = face_offset[t] + (int)buffer.faces.size();
+	}
+
+	vcolor->clear();
+	vertices->resize(vertex_offset[num_subtrees]);
+	v_faces->clear();
+	v_faces->resize(vertex_offset[num_subtrees]);
+	faces->resize(face_offset[num_subtrees]);
+	ParallelFor(0, num_subtrees, [&](int t) {
+		FaceBuffer& buffer = buffers[t];
+		int top = vertex_offset[t];
+		for (int i = 0; i < (int)buffer.keys.size(); ++i)
+		{
+			if (buffer.shared[i])
+				continue;
+			buffer.global[i] = top;
+			(*vertices)[top] = buffer.vertices[i];
+			(*v_faces)[top].swap(buffer.v_faces[i]);
+			top += 1;
+		}
+	});
+	ParallelFor(0, num_subtrees, [&](int t) {
+		FaceBuffer& buffer = buffers[t];
+		for (int i = 0; i < (int)buffer.keys.size(); ++i)
+		{
+			if (buffer.shared[i])
+			{
+				const auto& owner = owners.find(buffer.keys[i])->second;
+				buffer.global[i] = buffers[owner.first].global[owner.second];
+			}
+		}
+		for (int i = 0; i < (int)buffer.faces.size(); ++i)
+		{
+			Vector4i f = buffer.faces[i];
+			for (int j = 0; j < 4; ++j)
+				f[j] = buffer.global[f[j]];
+			(*faces)[face_offset[t] + i] = f;
+		}
+	});
+
+	std::vector<std::pair<GridIndex,int> > sorted_keys;
+	sorted_keys.reserve(vertices->size());
+	for (int t = 0; t < num_subtrees; ++t)
+	{
+		FaceBuffer& buffer = buffers[t];
+		for (int i = 0; i < (int)buffer.keys.size(); ++i)
+		{
+			if (buffer.shared[i])
+				(*v_faces)[buffer.global[i]].insert(
+					buffer.v_faces[i].begin(), buffer.v_faces[i].end());
+			else
+				sorted_keys.push_back(std::make_pair(buffer.keys[i],
+					buffer.global[i]));
+		}
+	}
+	std::sort(sorted_keys.begin(), sorted_keys.end(),
+		[](const std::pair<GridIndex,int>& a, const std::pair<GridIndex,int>& b) {
+			return a.first < b.first;
+		});
+	for (auto& info : sorted_keys)
+		vcolor->insert(vcolor->end(), info);
+}
@@ -9,6 +9,8 @@
 
 #include "GridIndex.h"
 
+class VoxelBitmap;
+
 class Octree
 {
 public:
@@ -24,6 +26,14 @@ public:
 
 
 	void Split(const MatrixD& V);
+	// Same tree as calling Split depth times on a fresh root, built bottom
+	// up: each triangle is binned into its finest cells in parallel, the
+	// (cell, triangle) pairs are radix sorted, and the occupied nodes are
+	// created along the sorted keys. Leaves keep F_/Find_ as Split would,
+	// so the tree can still be refined with Split afterwards.
+	void Build(const MatrixD& V, int depth);
+	void CreateChildren();
+	void ClearConnection();
 	void BuildConnection();
 	void ConnectTree(Octree* l, Octree* r, int dim);
 	void ConnectEmptyTree(Octree* l, Octree* r, int dim);
@@ -33,7 +43,21 @@ public:
 
 	void BuildEmptyConnection();
 
-	void ConstructFace(const Vector3i& start,
+	// Bytes held by this subtree: nodes, triangle lists and empty-node
+	// neighbor lists.
+	size_t MemoryBytes() const;
+
+	// Leaf faces are emitted toward exterior neighbor cells, looked up in
+	// bitmap instead of following empty_connection_.
+	void ConstructFace(const Vector3i& start, const VoxelBitmap& bitmap,
+		std::map<GridIndex,int>* vcolor,
+		std::vector<Vector3>* vertices,
+		std::vector<Vector4i>* faces,
+		std::vector<std::set<int> >* v_faces);
+	// Produces the same output as ConstructFace from the root. Subtrees are
+	// extracted in parallel and merged in traversal order; vertices shared
+	// between subtrees can only lie on subtree boundaries.
+	void ConstructFaceParallel(const VoxelBitmap& bitmap,
 		std::map<GridIndex,int>* vcolor,
 		std::vector<Vector3>* vertices,
 		std::vector<Vector4i>* faces,
@@ -0,0 +1,38 @@
+#ifndef MANIFOLD2_PARALLEL_H_
+#define MANIFOLD2_PARALLEL_H_
+
+#include "ThreadPool.h"
+
+// Sets the number of threads used by ParallelFor/ParallelReduce, counting
+// the caller; non-positive values use one per hardware thread. With
+// pin_threads the workers are bound to fixed CPUs of the process's
+// affinity mask, starting after its first_cpu-th one.
+inline void SetNumThreads(int threads, bool pin_threads = false,
+	int first_cpu = 0)
+{
+	ThreadPool::Instance().Configure(threads, pin_threads, first_cpu);
+}
+
+inline int NumThreads()
+{
+	return ThreadPool::Instance().NumThreads();
+}
+
+// Calls func(i) for every i in [begin, end). Iterations must not depend on
+// each other; nested calls share the same threads.
+template <class Func>
+void ParallelFor(int begin, int end, const Func& func)
+{
+	ThreadPool::Instance().ParallelFor(begin, end, 0, func);
+}
+
+// Folds map(i) over [begin, end) with combine, deterministically.
+template <class T, class Map, class Combine>
+T ParallelReduce(int begin, int end, const T& identity, const Map& map,
+	const Combine& combine)
+{
+	return ThreadPool::Instance().ParallelReduce(begin, end, 1024, identity,
+		map, combine);
+}
+
+#endif
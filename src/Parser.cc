@@ -1,19 +1,30 @@
 #include "Parser.h"
 
+#include "Log.h"
+
 Parser::Parser()
 {
 }
 
-void Parser::ParseArgument(int argc, char** argv) {
-	for (int i = 1; i < argc - 1; ++i) {
+bool Parser::ParseArgument(int argc, char** argv) {
+	for (int i = 1; i < argc; ++i) {
 		std::string s = argv[i];
-		if (s.size() < 2)
-			continue;
-		if (s[0] == '-' && s[1] == '-') {
-			s = s.substr(2, s.size() - 2);
-			arguments_[s] = argv[i + 1];
+		if (s.size() < 3 || s[0] != '-' || s[1] != '-') {
+			Logf(LOG_ERROR, "Unexpected argument: %s", s.c_str());
+			return false;
+		}
+		s = s.substr(2, s.size() - 2);
+		if (arguments_.count(s) == 0) {
+			Logf(LOG_ERROR, "Unknown argument: --%s", s.c_str());
+			return false;
 		}
+		if (i + 1 == argc) {
+			Logf(LOG_ERROR, "Missing value for argument: --%s", s.c_str());
+			return false;
+		}
+		arguments_[s] = argv[++i];
 	}
+	return true;
 }
 
 void Parser::AddArgument(const std::string& key, const std::string& value) {
@@ -28,19 +39,19 @@ std::string Parser::GetArgument(const std::string& key) {
 
 std::string Parser::operator[](const std::string& key) {
 	if (arguments_.count(key) == 0) {
-		printf("Argument not found: %s\n", key.c_str());
-		exit(0);
+		Logf(LOG_WARNING, "Argument not found: %s", key.c_str());
+		return "";
 	}
 	return arguments_[key];
 }
 
 void Parser::Log() {
-	printf("##################### Arguments #####################\n");
+	Logf(LOG_INFO, "##################### Arguments #####################");
 	for (auto& info : arguments_) {
 		if (info.second.size() > 0)
-			printf("%s: %s.\n", info.first.c_str(), info.second.c_str());
+			Logf(LOG_INFO, "%s: %s.", info.first.c_str(), info.second.c_str());
 		else
-			printf("%s: None.\n", info.first.c_str());
+			Logf(LOG_INFO, "%s: None.", info.first.c_str());
 	}
-	printf("#####################################################\n");
+	Logf(LOG_INFO, "#####################################################");
 }
\ No newline at end of file
@@ -9,10 +9,13 @@ class Parser
 public:
 	Parser();
 
-	void ParseArgument(int argc, char** argv);
+	// Reads "--key value" pairs. Returns false (after logging why) on an
+	// unknown key, a flag without a value or a stray token.
+	bool ParseArgument(int argc, char** argv);
 	void AddArgument(const std::string& key, const std::string& value);
 
 	std::string GetArgument(const std::string& key);
+	// Same as GetArgument, but warns when the key was never added.
 	std::string operator[](const std::string& key);
 
 	void Log();
@@ -0,0 +1,43 @@
+#ifndef MANIFOLD2_PROGRESS_H_
+#define MANIFOLD2_PROGRESS_H_
+
+#include <atomic>
+#include <functional>
+
+// Progress reports and cancellation for one job. Each stage reports the
+// fraction of its own work done, from 0 to 1; multi-level runs repeat the
+// stages once per level. The callback runs on the thread that drives the
+// job, never inside a parallel loop. Cancel may be called from any thread,
+// including from the callback; the job stops at the next report.
+class Progress
+{
+public:
+	typedef std::function<void(const char* stage, double fraction)> Callback;
+
+	Progress() : cancelled_(false) {}
+	explicit Progress(const Callback& callback)
+	: callback_(callback), cancelled_(false) {}
+
+	void SetCallback(const Callback& callback) { callback_ = callback; }
+	void Cancel() { cancelled_.store(true); }
+	bool Cancelled() const { return cancelled_.load(); }
+	// Returns false once the job is cancelled.
+	bool Report(const char* stage, double fraction) {
+		if (callback_)
+			callback_(stage, fraction);
+		return !Cancelled();
+	}
+
+private:
+	Callback callback_;
+	std::atomic<bool> cancelled_;
+};
+
+// Report through an optional progress object; false means stop.
+inline bool ReportProgress(Progress* progress, const char* stage,
+	double fraction)
+{
+	return !progress || progress->Report(stage, fraction);
+}
+
+#endif
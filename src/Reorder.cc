@@ -0,0 +1,81 @@
+#include "Reorder.h"
+
+#include <algorithm>
+
+#include "Parallel.h"
+
+// Spreads the low 21 bits of x so that there are two zero bits between
+// any two of them.
+static unsigned long long SpreadBits(unsigned long long x)
+{
+	x &= 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffffULL;
+	x = (x | x << 16) & 0x1f0000ff0000ffULL;
+	x = (x | x << 8) & 0x100f00f00f00f00fULL;
+	x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+	x = (x | x << 2) & 0x1249249249249249ULL;
+	return x;
+}
+
+void MortonOrder(const MatrixD& V, std::vector<int>* order)
+{
+	int num_V = (int)V.rows();
+	order->resize(num_V);
+	if (num_V == 0)
+		return;
+	Vector3 min_corner = V.colwise().minCoeff();
+	Vector3 max_corner = V.colwise().maxCoeff();
+	FT extent = std::max((max_corner - min_corner).maxCoeff(), (FT)1e-30);
+	FT scale = ((1 << 21) - 1) / extent;
+
+	std::vector<std::pair<unsigned long long, int> > keys(num_V);
+	ParallelFor(0, num_V, [&](int i) {
+		unsigned long long code = 0;
+		for (int j = 0; j < 3; ++j) {
+			unsigned long long q = (V(i, j) - min_corner[j]) * scale;
+			code |= SpreadBits(q) << (2 - j);
+		}
+		keys[i] = std::make_pair(code, i);
+	});
+	std::sort(keys.begin(), keys.end());
+	for (int i = 0; i < num_V; ++i)
+		(*order)[i] = keys[i].second;
+}
+
+void ReorderMesh(MatrixD* V, MatrixI* F,
+	std::vector<int>* vertex_order, std::vector<int>* face_order)
+{
+	int num_V = (int)V->rows();
+	int num_F = (int)F->rows();
+	MortonOrder(*V, vertex_order);
+	std::vector<int> rank(num_V);
+	for (int i = 0; i < num_V; ++i)
+		rank[(*vertex_order)[i]] = i;
+
+	// counting sort of faces by their smallest new vertex index
+	std::vector<int> offset(num_V + 1, 0);
+	std::vector<int> first(num_F);
+	for (int i = 0; i < num_F; ++i) {
+		first[i] = std::min(rank[(*F)(i, 0)],
+			std::min(rank[(*F)(i, 1)], rank[(*F)(i, 2)]));
+		offset[first[i] + 1] += 1;
+	}
+	for (int i = 0; i < num_V; ++i)
+		offset[i + 1] += offset[i];
+	face_order->resize(num_F);
+	for (int i = 0; i < num_F; ++i)
+		(*face_order)[offset[first[i]]++] = i;
+
+	MatrixD nV(num_V, 3);
+	MatrixI nF(num_F, 3);
+	ParallelFor(0, num_V, [&](int i) {
+		nV.row(i) = V->row((*vertex_order)[i]);
+	});
+	ParallelFor(0, num_F, [&](int i) {
+		int f = (*face_order)[i];
+		for (int j = 0; j < 3; ++j)
+			nF(i, j) = rank[(*F)(f, j)];
+	});
+	V->swap(nV);
+	F->swap(nF);
+}
@@ -0,0 +1,18 @@
+#ifndef MANIFOLD2_REORDER_H_
+#define MANIFOLD2_REORDER_H_
+
+#include <vector>
+
+#include "types.h"
+
+// Orders the rows of V along a Morton curve over their bounding box.
+// order[k] is the original index of the k-th point.
+void MortonOrder(const MatrixD& V, std::vector<int>* order);
+
+// Renumbers vertices along a Morton curve and sorts faces by their first
+// vertex in the new numbering, then rewrites V and F in place.
+// vertex_order and face_order map new indices to the original ones.
+void ReorderMesh(MatrixD* V, MatrixI* F,
+	std::vector<int>* vertex_order, std::vector<int>* face_order);
+
+#endif
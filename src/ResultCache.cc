@@ -0,0 +1,263 @@
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "Log.h"
+
+static const char kMagic[8] = {'M', 'P', 'C', 'A', 'C', 'H', 'E', '1'};
+static const char kSuffix[] = ".mpc";
+
+struct CacheHeader
+{
+	char magic[8];
+	uint64_t hash[2];
+	int32_t depth;
+	int32_t reserved;
+	int64_t num_V;
+	int64_t num_F;
+};
+
+static inline uint64_t Rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// splitmix64 finalizer
+static inline uint64_t Mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// Two independent lanes over 8-byte words; fast enough to stay well
+// below the cost of reading the mesh.
+class Hasher
+{
+public:
+	Hasher() : a_(0x9e3779b97f4a7c15ULL), b_(0xc2b2ae3d27d4eb4fULL),
+		length_(0) {}
+
+	void Add(const void* data, size_t bytes) {
+		const unsigned char* p = (const unsigned char*)data;
+		length_ += bytes;
+		for (; bytes >= 8; bytes -= 8, p += 8) {
+			uint64_t w;
+			memcpy(&w, p, 8);
+			Word(w);
+		}
+		if (bytes > 0) {
+			uint64_t w = 0;
+			memcpy(&w, p, bytes);
+			Word(w ^ ((uint64_t)bytes << 56));
+		}
+	}
+
+	CacheKey Finish() const {
+		CacheKey key;
+		uint64_t a = a_ ^ length_, b = b_ ^ length_;
+		a += b;
+		b += a;
+		key.hash[0] = Mix(a);
+		key.hash[1] = Mix(b);
+		return key;
+	}
+
+private:
+	void Word(uint64_t w) {
+		a_ = Rotl(a_ ^ Mix(w), 27) * 5 + 0x52dce729;
+		b_ = Rotl(b_ + Mix(w ^ 0x6a09e667f3bcc909ULL), 31) * 5 + 0x38495ab5;
+	}
+
+	uint64_t a_, b_;
+	uint64_t length_;
+};
+
+// Rows of a matrix view, which may have an outer stride.
+template <class Matrix>
+static void HashRows(const Matrix& M, Hasher* hasher)
+{
+	int64_t size[2] = {M.rows(), M.cols()};
+	hasher->Add(size, sizeof(size));
+	typedef typename Matrix::Scalar Scalar;
+	if (M.outerStride() == M.cols()) {
+		hasher->Add(M.data(), sizeof(Scalar) * M.size());
+		return;
+	}
+	for (int i = 0; i < (int)M.rows(); ++i)
+		hasher->Add(M.data() + i * M.outerStride(), sizeof(Scalar) * M.cols());
+}
+
+std::string CacheKey::Hex() const
+{
+	char buffer[33];
+	snprintf(buffer, sizeof(buffer), "%016llx%016llx",
+		(unsigned long long)hash[0], (unsigned long long)hash[1]);
+	return buffer;
+}
+
+ResultCache::ResultCache(const std::string& directory, double max_mb)
+	: directory_(directory), max_bytes_(max_mb * 1024 * 1024)
+{
+	if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST)
+		Logf(LOG_WARNING, "Cannot create cache directory %s",
+			directory_.c_str());
+}
+
+CacheKey ResultCache::Key(const MatrixDRef& V, const MatrixIRef& F,
+	const std::string& parameters)
+{
+	Hasher hasher;
+	HashRows(V, &hasher);
+	HashRows(F, &hasher);
+	hasher.Add(parameters.data(), parameters.size());
+	return hasher.Finish();
+}
+
+std::string ResultCache::Path(const CacheKey& key) const
+{
+	return directory_ + "/" + key.Hex() + kSuffix;
+}
+
+bool ResultCache::Load(const CacheKey& key, MatrixD* V, MatrixI* F,
+	int* depth)
+{
+	std::string path = Path(key);
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(CacheHeader)) {
+		close(fd);
+		return false;
+	}
+	size_t bytes = info.st_size;
+	void* mapped = mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+
+	CacheHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	const char* data = (const char*)mapped + sizeof(header);
+	bool valid = memcmp(header.magic, kMagic, sizeof(kMagic)) == 0
+		&& header.hash[0] == key.hash[0] && header.hash[1] == key.hash[1]
+		&& header.num_V >= 0 && header.num_F >= 0
+		&& bytes == sizeof(header) + header.num_V * 3 * sizeof(FT)
+			+ header.num_F * 3 * sizeof(int);
+	if (valid) {
+		V->resize(header.num_V, 3);
+		F->resize(header.num_F, 3);
+		memcpy(V->data(), data, V->size() * sizeof(FT));
+		memcpy(F->data(), data + V->size() * sizeof(FT),
+			F->size() * sizeof(int));
+		*depth = header.depth;
+	}
+	munmap(mapped, bytes);
+	if (!valid) {
+		Logf(LOG_WARNING, "Ignoring corrupt cache entry %s", path.c_str());
+		return false;
+	}
+	// mark as recently used for eviction
+	utimes(path.c_str(), 0);
+	return true;
+}
+
+bool ResultCache::Store(const CacheKey& key, const MatrixD& V,
+	const MatrixI& F, int depth)
+{
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.hash[0] = key.hash[0];
+	header.hash[1] = key.hash[1];
+	header.depth = depth;
+	header.num_V = V.rows();
+	header.num_F = F.rows();
+
+	std::string path = Path(key);
+	// unique per writer, so concurrent stores of one key never mix
+	static std::atomic<int> counter(0);
+	char suffix[48];
+	snprintf(suffix, sizeof(suffix), ".%d.%d.tmp", (int)getpid(), counter++);
+	std::string temp = path + suffix;
+	FILE* file = fopen(temp.c_str(), "wb");
+	if (!file) {
+		Logf(LOG_WARNING, "Cannot write cache entry %s", temp.c_str());
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(V.data(), sizeof(FT), V.size(), file) == (size_t)V.size()
+		&& fwrite(F.data(), sizeof(int), F.size(), file) == (size_t)F.size();
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+		Logf(LOG_WARNING, "Cannot write cache entry %s", path.c_str());
+		unlink(temp.c_str());
+		return false;
+	}
+	if (max_bytes_ > 0)
+		Evict(max_bytes_);
+	return true;
+}
+
+void ResultCache::Evict(double max_bytes)
+{
+	struct Entry {
+		std::string path;
+		double bytes;
+		double used;
+	};
+	DIR* dir = opendir(directory_.c_str());
+	if (!dir)
+		return;
+	std::vector<Entry> entries;
+	double total = 0;
+	size_t suffix_length = strlen(kSuffix);
+	while (struct dirent* item = readdir(dir)) {
+		std::string name = item->d_name;
+		if (name.size() <= suffix_length || name.compare(
+			name.size() - suffix_length, suffix_length, kSuffix) != 0)
+			continue;
+		Entry entry;
+		entry.path = directory_ + "/" + name;
+		struct stat info;
+		if (stat(entry.path.c_str(), &info) != 0)
+			continue;
+		entry.bytes = info.st_size;
+		entry.used = info.st_mtime;
+#ifdef __linux__
+		entry.used += info.st_mtim.tv_nsec * 1e-9;
+#endif
+		total += entry.bytes;
+		entries.push_back(entry);
+	}
+	closedir(dir);
+	if (total <= max_bytes)
+		return;
+	std::sort(entries.begin(), entries.end(),
+		[](const Entry& a, const Entry& b) {
+			return a.used < b.used || (a.used == b.used && a.path < b.path);
+		});
+	for (auto& entry : entries) {
+		if (total <= max_bytes)
+			break;
+		if (unlink(entry.path.c_str()) == 0) {
+			total -= entry.bytes;
+			Logf(LOG_INFO, "Evicted cache entry %s", entry.path.c_str());
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef MANIFOLD2_RESULT_CACHE_H_
+#define MANIFOLD2_RESULT_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "types.h"
+
+// 128-bit hash of an input mesh and every parameter that shapes the result.
+struct CacheKey
+{
+	uint64_t hash[2];
+	std::string Hex() const;
+};
+
+// On-disk cache of finished results, one binary file per key in a single
+// directory: a fixed header (magic, key, depth, sizes) followed by the raw
+// rows of V and F. Files are read through mmap and written to a temporary
+// name, then renamed, so concurrent processes can share the directory.
+// Each hit refreshes the file's modification time; after a store the
+// least recently used files are removed until the total fits max_mb.
+class ResultCache
+{
+public:
+	// Creates directory if needed; max_mb <= 0 never evicts.
+	ResultCache(const std::string& directory, double max_mb);
+
+	// Hashes the buffers of V and F and the parameter string.
+	static CacheKey Key(const MatrixDRef& V, const MatrixIRef& F,
+		const std::string& parameters);
+	// False on a miss or on a file that does not match key.
+	bool Load(const CacheKey& key, MatrixD* V, MatrixI* F, int* depth);
+	bool Store(const CacheKey& key, const MatrixD& V, const MatrixI& F,
+		int depth);
+	// Removes least recently used entries until at most max_bytes remain.
+	void Evict(double max_bytes);
+
+private:
+	std::string Path(const CacheKey& key) const;
+
+	std::string directory_;
+	double max_bytes_;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "ThreadPool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// queue of the current thread: a worker index, or -1 outside the pool
+static thread_local int tls_queue = -1;
+
+ThreadPool& ThreadPool::Instance()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool::ThreadPool()
+	: num_threads_(1), queued_(0), stop_(false)
+{
+	Start(0, false, 0);
+}
+
+ThreadPool::~ThreadPool()
+{
+	Stop();
+}
+
+void ThreadPool::Configure(int threads, bool pin_threads, int first_cpu)
+{
+	Stop();
+	Start(threads, pin_threads, first_cpu);
+}
+
+// CPUs in the affinity mask of the process, e.g. its cgroup cpuset or
+// taskset list; empty where that cannot be read.
+static std::vector<int> AllowedCpus()
+{
+	std::vector<int> cpus;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			if (CPU_ISSET(cpu, &set))
+				cpus.push_back(cpu);
+	}
+#endif
+	return cpus;
+}
+
+void ThreadPool::Start(int threads, bool pin_threads, int first_cpu)
+{
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	num_threads_ = threads;
+	stop_ = false;
+	queued_ = 0;
+	queues_.resize(threads);
+	for (auto& q : queues_)
+		q = new Queue();
+	std::vector<int> cpus;
+	if (pin_threads)
+		cpus = AllowedCpus();
+	for (int i = 0; i < threads - 1; ++i) {
+		int cpu = cpus.empty() ? -1
+			: cpus[(std::max(first_cpu, 0) + i + 1) % cpus.size()];
+		workers_.push_back(std::thread(&ThreadPool::WorkerLoop, this, i, cpu));
+	}
+}
+
+void ThreadPool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+	for (auto& worker : workers_)
+		worker.join();
+	workers_.clear();
+	for (auto& q : queues_)
+		delete q;
+	queues_.clear();
+}
+
+void ThreadPool::WorkerLoop(int index, int cpu)
+{
+	tls_queue = index;
+#ifdef __linux__
+	if (cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+#endif
+	while (!stop_) {
+		if (RunOne())
+			continue;
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		wake_.wait(lock, [&] { return stop_ || queued_ > 0; });
+	}
+}
+
+bool ThreadPool::RunOne()
+{
+	int num_queues = (int)queues_.size();
+	int own = (tls_queue >= 0) ? tls_queue : num_queues - 1;
+	Task task;
+	bool found = false;
+	for (int k = 0; k < num_queues && !found; ++k) {
+		Queue& q = *queues_[(own + k) % num_queues];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.tasks.empty())
+			continue;
+		// own work newest first, stolen work oldest first
+		if (k == 0) {
+			task = q.tasks.back();
+			q.tasks.pop_back();
+		} else {
+			task = q.tasks.front();
+			q.tasks.pop_front();
+		}
+		found = true;
+	}
+	if (!found)
+		return false;
+	queued_ -= 1;
+	task.run(task.job, task.begin, task.end);
+	// Counted down under the mutex: the waiter takes it before returning,
+	// so the latch outlives this notify.
+	Latch& latch = *task.latch;
+	std::lock_guard<std::mutex> lock(latch.mutex);
+	if (latch.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		latch.done.notify_all();
+	return true;
+}
+
+void ThreadPool::Submit(const Task* tasks, int count)
+{
+	int own = (tls_queue >= 0) ? tls_queue : (int)queues_.size() - 1;
+	Queue& q = *queues_[own];
+	{
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.tasks.insert(q.tasks.end(), tasks, tasks + count);
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		queued_ += count;
+	}
+	wake_.notify_all();
+}
+
+void ThreadPool::Wait(Latch& latch)
+{
+	// a few rounds of looking for work before going to sleep
+	const int kSpins = 64;
+	int idle = 0;
+	while (latch.pending.load(std::memory_order_acquire) > 0) {
+		if (RunOne()) {
+			idle = 0;
+			continue;
+		}
+		if (++idle < kSpins) {
+			std::this_thread::yield();
+			continue;
+		}
+		// Every chunk left is running on another thread, and whatever it
+		// submits that thread runs itself while waiting.
+		std::unique_lock<std::mutex> lock(latch.mutex);
+		latch.done.wait(lock, [&] {
+			return latch.pending.load(std::memory_order_acquire) == 0;
+		});
+	}
+	std::lock_guard<std::mutex> lock(latch.mutex);
+}
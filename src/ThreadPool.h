@@ -0,0 +1,145 @@
+#ifndef MANIFOLD2_THREAD_POOL_H_
+#define MANIFOLD2_THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process-wide task scheduler behind ParallelFor. Every worker owns a
+// deque: it pops its own tasks from the back and steals from the front of
+// the others. Threads that wait for a parallel loop run queued tasks
+// instead of blocking, so nested loops reuse the same workers and never
+// add threads.
+class ThreadPool
+{
+public:
+	static ThreadPool& Instance();
+
+	// Restarts the pool with the given number of threads, counting the
+	// calling thread; non-positive means one per hardware thread and 1
+	// runs everything inline. With pin_threads, worker i is bound to the
+	// (first_cpu + i + 1)-th CPU, round robin, of the ones the process may
+	// run on (Linux only); jobs sharing a node give disjoint first_cpu
+	// ranges. Must not be called from inside a parallel loop.
+	void Configure(int threads, bool pin_threads = false, int first_cpu = 0);
+	int NumThreads() const { return num_threads_; }
+
+	// Calls func(i) for every i in [begin, end), in chunks of at most
+	// grain iterations; grain <= 0 picks about eight chunks per thread.
+	template <class Func>
+	void ParallelFor(int begin, int end, int grain, const Func& func);
+
+	// Folds map(i) over [begin, end) with combine. Chunk boundaries depend
+	// only on grain and partial results are combined in chunk order, so
+	// the result does not depend on the thread count or scheduling.
+	template <class T, class Map, class Combine>
+	T ParallelReduce(int begin, int end, int grain, const T& identity,
+		const Map& map, const Combine& combine);
+
+private:
+	// Chunks of one parallel loop still to finish; the chunk that brings
+	// pending to 0 wakes the thread waiting for the loop.
+	struct Latch {
+		explicit Latch(int count) : pending(count) {}
+		std::atomic<int> pending;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	struct Task {
+		void (*run)(const void* job, int begin, int end);
+		const void* job;
+		int begin, end;
+		Latch* latch;
+	};
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	ThreadPool();
+	~ThreadPool();
+	void Start(int threads, bool pin_threads, int first_cpu);
+	void Stop();
+	// cpu is the CPU to bind the worker to, or -1
+	void WorkerLoop(int index, int cpu);
+	// Runs one queued task, preferring the queue of this thread. Returns
+	// false when every queue was empty.
+	bool RunOne();
+	void Submit(const Task* tasks, int count);
+	// Runs queued tasks until latch opens; once the queues stay empty,
+	// sleeps instead of spinning while the last chunks finish elsewhere.
+	void Wait(Latch& latch);
+
+	template <class Func>
+	static void RunRange(const void* job, int begin, int end) {
+		const Func& func = *static_cast<const Func*>(job);
+		for (int i = begin; i < end; ++i)
+			func(i);
+	}
+
+	int num_threads_;
+	// one queue per worker, plus one shared by threads outside the pool
+	std::vector<Queue*> queues_;
+	std::vector<std::thread> workers_;
+	std::atomic<int> queued_;
+	std::atomic<bool> stop_;
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;
+};
+
+template <class Func>
+void ThreadPool::ParallelFor(int begin, int end, int grain, const Func& func)
+{
+	int n = end - begin;
+	if (n <= 0)
+		return;
+	if (grain <= 0)
+		grain = std::max(1, n / (num_threads_ * 8));
+	if (num_threads_ == 1 || n <= grain) {
+		for (int i = begin; i < end; ++i)
+			func(i);
+		return;
+	}
+	int num_chunks = (n + grain - 1) / grain;
+	Latch latch(num_chunks);
+	std::vector<Task> tasks(num_chunks);
+	for (int c = 0; c < num_chunks; ++c) {
+		tasks[c].run = &RunRange<Func>;
+		tasks[c].job = &func;
+		tasks[c].begin = begin + c * grain;
+		tasks[c].end = std::min(end, begin + (c + 1) * grain);
+		tasks[c].latch = &latch;
+	}
+	Submit(tasks.data(), num_chunks);
+	Wait(latch);
+}
+
+template <class T, class Map, class Combine>
+T ThreadPool::ParallelReduce(int begin, int end, int grain,
+	const T& identity, const Map& map, const Combine& combine)
+{
+	int n = end - begin;
+	if (n <= 0)
+		return identity;
+	if (grain <= 0)
+		grain = 1024;
+	int num_chunks = (n + grain - 1) / grain;
+	std::vector<T> partial(num_chunks, identity);
+	ParallelFor(0, num_chunks, 1, [&](int c) {
+		int chunk_end = std::min(end, begin + (c + 1) * grain);
+		T value = identity;
+		for (int i = begin + c * grain; i < chunk_end; ++i)
+			value = combine(value, map(i));
+		partial[c] = value;
+	});
+	T result = identity;
+	for (int c = 0; c < num_chunks; ++c)
+		result = combine(result, partial[c]);
+	return result;
+}
+
+#endif
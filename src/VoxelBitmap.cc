@@ -0,0 +1,414 @@
+#include "VoxelBitmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Octree.h"
+#include "Parallel.h"
+
+VoxelBitmap::VoxelBitmap()
+	: tree_(0), depth_(0), resolution_(0), unit_root_(false), filled_(false)
+{}
+
+void VoxelBitmap::Clear()
+{
+	tree_ = 0;
+	depth_ = 0;
+	resolution_ = 0;
+	unit_root_ = false;
+	block_index_.clear();
+	blocks_.clear();
+	filled_ = false;
+	exterior_nodes_.clear();
+}
+
+static void CollectLeaves(Octree* node, const Vector3i& start,
+	std::vector<Vector3i>* cells)
+{
+	if (!node->occupied_)
+		return;
+	if (node->level_ == 0) {
+		cells->push_back(start);
+		return;
+	}
+	for (int i = 0; i < 8; ++i) {
+		int x = i / 4;
+		int y = (i - x * 4) / 2;
+		int z = i - x * 4 - y * 2;
+		CollectLeaves(node->children_[i], start * 2 + Vector3i(x,y,z), cells);
+	}
+}
+
+void VoxelBitmap::Build(Octree* tree)
+{
+	Clear();
+	tree_ = tree;
+	depth_ = tree->level_;
+	resolution_ = 1 << depth_;
+	unit_root_ = tree->min_corner_ == Vector3(0,0,0)
+		&& tree->volume_size_ == Vector3(1,1,1);
+
+	std::vector<Vector3i> cells;
+	CollectLeaves(tree, Vector3i(0,0,0), &cells);
+
+	// blocks touched by an occupied cell or its 26 neighbors
+	std::vector<long long> keys;
+	keys.reserve(cells.size() * 2);
+	for (auto& c : cells) {
+		Vector3i lo, hi;
+		for (int i = 0; i < 3; ++i) {
+			lo[i] = std::max(c[i] - 1, 0) >> 3;
+			hi[i] = std::min(c[i] + 1, resolution_ - 1) >> 3;
+		}
+		for (int x = lo[0]; x <= hi[0]; ++x)
+			for (int y = lo[1]; y <= hi[1]; ++y)
+				for (int z = lo[2]; z <= hi[2]; ++z)
+					keys.push_back(BlockKey(x, y, z));
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	int num_blocks = (int)keys.size();
+	blocks_.resize(num_blocks);
+	block_index_.reserve(num_blocks);
+	for (int i = 0; i < num_blocks; ++i)
+		block_index_[keys[i]] = i;
+
+	const long long mask = (1 << 20) - 1;
+	ParallelFor(0, num_blocks, [&](int i) {
+		Block& block = blocks_[i];
+		memset(&block, 0, sizeof(Block));
+		Vector3i block_origin((int)(keys[i] >> 40) * 8,
+			(int)((keys[i] >> 20) & mask) * 8, (int)(keys[i] & mask) * 8);
+		FillBlock(tree_, Vector3i(0,0,0), resolution_, block_origin, &block);
+	});
+}
+
+struct VoxelBitmap::FillStack {
+	// Empty nodes with their first cell and size. Split leaves level_ of
+	// unoccupied nodes as created, so sizes come from the descent.
+	struct Node {
+		Octree* node;
+		Vector3i origin;
+		int size;
+	};
+	std::vector<Node> nodes;
+	// surface block index * 512 + bit for single cells
+	std::vector<long long> cells;
+};
+
+void VoxelBitmap::FloodFill(Octree* tree)
+{
+	Clear();
+	tree_ = tree;
+	depth_ = tree->level_;
+	resolution_ = 1 << depth_;
+	unit_root_ = tree->min_corner_ == Vector3(0,0,0)
+		&& tree->volume_size_ == Vector3(1,1,1);
+	filled_ = true;
+
+	std::vector<Vector3i> cells;
+	CollectLeaves(tree, Vector3i(0,0,0), &cells);
+
+	// surface blocks: the ones holding an occupied cell
+	std::vector<long long> keys(cells.size());
+	for (int i = 0; i < (int)cells.size(); ++i)
+		keys[i] = BlockKey(cells[i][0] >> 3, cells[i][1] >> 3, cells[i][2] >> 3);
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	int num_blocks = (int)keys.size();
+	blocks_.resize(num_blocks);
+	memset(blocks_.data(), 0, sizeof(Block) * num_blocks);
+	block_index_.reserve(num_blocks);
+	for (int i = 0; i < num_blocks; ++i)
+		block_index_[keys[i]] = i;
+	for (auto& c : cells) {
+		Block& block = blocks_[block_index_[BlockKey(c[0] >> 3, c[1] >> 3,
+			c[2] >> 3)]];
+		block.occupied[c[0] & 7] |= (uint64_t)1 << ((c[1] & 7) * 8 + (c[2] & 7));
+	}
+	std::vector<Vector3i>().swap(cells);
+	std::vector<Vector3i> origins(num_blocks);
+	const long long mask = (1 << 20) - 1;
+	for (int i = 0; i < num_blocks; ++i) {
+		origins[i] = Vector3i((int)(keys[i] >> 40),
+			(int)((keys[i] >> 20) & mask), (int)(keys[i] & mask)) * 8;
+	}
+
+	Vector3i dir[6] = {Vector3i(1,0,0), Vector3i(0,1,0), Vector3i(0,0,1),
+		Vector3i(-1,0,0), Vector3i(0,-1,0), Vector3i(0,0,-1)};
+	Vector3i root(0,0,0), end(resolution_, resolution_, resolution_);
+	FillStack stack;
+	// seeds: the empty cells on each face of the root
+	for (int i = 0; i < 6; ++i) {
+		int axis = i % 3;
+		Vector3i lo = root, hi = end;
+		if (i < 3)
+			lo[axis] = resolution_ - 1;
+		else
+			hi[axis] = 1;
+		VisitBox(tree_, root, resolution_, lo, hi, &stack);
+	}
+
+	while (!stack.nodes.empty() || !stack.cells.empty()) {
+		if (!stack.nodes.empty()) {
+			Vector3i origin = stack.nodes.back().origin;
+			int size = stack.nodes.back().size;
+			stack.nodes.pop_back();
+			// the one-cell thick slab beyond each face of the node
+			for (int i = 0; i < 6; ++i) {
+				int axis = i % 3;
+				Vector3i lo = origin, hi = origin + Vector3i(size, size, size);
+				if (i < 3) {
+					lo[axis] = hi[axis];
+					hi[axis] += 1;
+				} else {
+					hi[axis] = lo[axis];
+					lo[axis] -= 1;
+				}
+				if (lo[axis] >= 0 && hi[axis] <= resolution_)
+					VisitBox(tree_, root, resolution_, lo, hi, &stack);
+			}
+			continue;
+		}
+		long long entry = stack.cells.back();
+		stack.cells.pop_back();
+		int index = (int)(entry / 512);
+		int local = (int)(entry % 512);
+		Vector3i l(local / 64, local / 8 % 8, local % 8);
+		Vector3i c = origins[index] + l;
+		for (int i = 0; i < 6; ++i) {
+			Vector3i n = c + dir[i];
+			Vector3i nl = l + dir[i];
+			if (n.minCoeff() < 0 || n.maxCoeff() >= resolution_)
+				continue;
+			if (nl.minCoeff() >= 0 && nl.maxCoeff() < 8)
+				VisitCell(index, nl[0], nl[1] * 8 + nl[2], &stack);
+			else
+				VisitBox(tree_, root, resolution_, n, n + Vector3i(1,1,1),
+					&stack);
+		}
+	}
+}
+
+void VoxelBitmap::VisitCell(int index, int x, int bit, FillStack* stack)
+{
+	Block& block = blocks_[index];
+	uint64_t flag = (uint64_t)1 << bit;
+	if ((block.occupied[x] | block.exterior[x]) & flag)
+		return;
+	block.exterior[x] |= flag;
+	stack->cells.push_back((long long)index * 512 + x * 64 + bit);
+}
+
+void VoxelBitmap::VisitBox(Octree* node, const Vector3i& origin, int size,
+	const Vector3i& lo, const Vector3i& hi, FillStack* stack)
+{
+	for (int i = 0; i < 3; ++i) {
+		if (origin[i] >= hi[i] || origin[i] + size <= lo[i])
+			return;
+	}
+	bool empty = !node->occupied_;
+	std::unordered_map<long long, int>::const_iterator block;
+	if (!empty && node->level_ <= 3) {
+		// a surface block, or the root when it is smaller than one
+		block = block_index_.find(BlockKey(origin[0] >> 3, origin[1] >> 3,
+			origin[2] >> 3));
+		// Split leaves a node occupied without occupied leaves if the
+		// overlap tests of the node and its children disagree; FindNode
+		// stops at it, so it is filled like an unoccupied node.
+		empty = block == block_index_.end();
+	}
+	if (empty) {
+		if (exterior_nodes_.insert(node).second) {
+			FillStack::Node entry = {node, origin, size};
+			stack->nodes.push_back(entry);
+		}
+		return;
+	}
+	if (node->level_ <= 3) {
+		int index = block->second;
+		Vector3i a = origin.cwiseMax(lo);
+		Vector3i b = (origin + Vector3i(size, size, size)).cwiseMin(hi);
+		for (int x = a[0]; x < b[0]; ++x)
+			for (int y = a[1]; y < b[1]; ++y)
+				for (int z = a[2]; z < b[2]; ++z)
+					VisitCell(index, x & 7, (y & 7) * 8 + (z & 7), stack);
+		return;
+	}
+	int half = size / 2;
+	for (int i = 0; i < 8; ++i) {
+		int x = i / 4;
+		int y = (i - x * 4) / 2;
+		int z = i - x * 4 - y * 2;
+		VisitBox(node->children_[i], origin + Vector3i(x,y,z) * half, half,
+			lo, hi, stack);
+	}
+}
+
+Octree* VoxelBitmap::FindNode(const Vector3i& cell, Vector3i* origin) const
+{
+	Octree* node = tree_;
+	Vector3i o(0,0,0);
+	int size = resolution_;
+	while (node->occupied_ && node->level_ > 3) {
+		size /= 2;
+		int child = 0;
+		for (int i = 0; i < 3; ++i) {
+			if (cell[i] >= o[i] + size) {
+				o[i] += size;
+				child |= 4 >> i;
+			}
+		}
+		node = node->children_[child];
+	}
+	if (origin)
+		*origin = o;
+	return node;
+}
+
+double VoxelBitmap::FloodFillBytes(double leaves)
+{
+	// A surface crosses a block in a few dozen cells, and the empty nodes
+	// outside surface blocks are children of occupied nodes of level 4 or
+	// more, of which there are few; a sixteenth of the leaves bounds both
+	// counts in practice.
+	double block = sizeof(Block) + sizeof(long long) + sizeof(int)
+		+ 2 * sizeof(void*);
+	double node = sizeof(Octree*) + 2 * sizeof(void*);
+	return leaves / 16 * (block + node);
+}
+
+void VoxelBitmap::FillBlock(Octree* node, const Vector3i& origin, int size,
+	const Vector3i& block_origin, Block* block) const
+{
+	for (int i = 0; i < 3; ++i) {
+		if (origin[i] >= block_origin[i] + 8
+			|| origin[i] + size <= block_origin[i])
+			return;
+	}
+	if (!node->occupied_) {
+		if (!node->exterior_)
+			return;
+		Vector3i lo, hi;
+		for (int i = 0; i < 3; ++i) {
+			lo[i] = std::max(origin[i], block_origin[i]) - block_origin[i];
+			hi[i] = std::min(origin[i] + size, block_origin[i] + 8)
+				- block_origin[i];
+		}
+		uint64_t row = 0;
+		for (int z = lo[2]; z < hi[2]; ++z)
+			row |= (uint64_t)1 << z;
+		for (int x = lo[0]; x < hi[0]; ++x)
+			for (int y = lo[1]; y < hi[1]; ++y)
+				block->exterior[x] |= row << (y * 8);
+		return;
+	}
+	if (node->level_ == 0) {
+		Vector3i c = origin - block_origin;
+		block->occupied[c[0]] |= (uint64_t)1 << (c[1] * 8 + c[2]);
+		return;
+	}
+	int half = size / 2;
+	for (int i = 0; i < 8; ++i) {
+		int x = i / 4;
+		int y = (i - x * 4) / 2;
+		int z = i - x * 4 - y * 2;
+		FillBlock(node->children_[i], origin + Vector3i(x,y,z) * half, half,
+			block_origin, block);
+	}
+}
+
+const VoxelBitmap::Block* VoxelBitmap::FindBlock(const Vector3i& cell) const
+{
+	for (int i = 0; i < 3; ++i)
+		if (cell[i] < 0 || cell[i] >= resolution_)
+			return 0;
+	auto it = block_index_.find(BlockKey(cell[0] >> 3, cell[1] >> 3,
+		cell[2] >> 3));
+	if (it == block_index_.end())
+		return 0;
+	return &blocks_[it->second];
+}
+
+bool VoxelBitmap::Occupied(const Vector3i& cell) const
+{
+	const Block* block = FindBlock(cell);
+	if (!block)
+		return false;
+	return (block->occupied[cell[0] & 7]
+		>> ((cell[1] & 7) * 8 + (cell[2] & 7))) & 1;
+}
+
+bool VoxelBitmap::Exterior(const Vector3i& cell) const
+{
+	for (int i = 0; i < 3; ++i)
+		if (cell[i] < 0 || cell[i] >= resolution_)
+			return false;
+	const Block* block = FindBlock(cell);
+	if (!block)
+		return filled_ && exterior_nodes_.count(FindNode(cell, 0)) > 0;
+	return (block->exterior[cell[0] & 7]
+		>> ((cell[1] & 7) * 8 + (cell[2] & 7))) & 1;
+}
+
+bool VoxelBitmap::Locate(const Vector3& p, Vector3i* cell) const
+{
+	const Vector3& min_corner = tree_->min_corner_;
+	const Vector3& volume_size = tree_->volume_size_;
+	for (int i = 0; i < 3; ++i)
+		if (p[i] < min_corner[i] || p[i] > min_corner[i] + volume_size[i])
+			return false;
+	if (unit_root_) {
+		// Cell boundaries are the exact fractions k / resolution_ and the
+		// descent sends ties to the lower cell, so the cell is the number
+		// of boundaries strictly below p.
+		for (int i = 0; i < 3; ++i)
+			(*cell)[i] = std::max(0, (int)std::ceil(p[i] * resolution_) - 1);
+		return true;
+	}
+	// same comparisons as the octree descent, so ties and rounding at cell
+	// boundaries resolve identically
+	Vector3 corner = min_corner, size = volume_size;
+	*cell = Vector3i(0,0,0);
+	for (int level = 0; level < depth_; ++level) {
+		Vector3 half = size * 0.5;
+		for (int i = 0; i < 3; ++i) {
+			(*cell)[i] *= 2;
+			if (p[i] > corner[i] + size[i] / 2) {
+				(*cell)[i] += 1;
+				corner[i] += half[i];
+			}
+			if (p[i] < corner[i] || p[i] > corner[i] + half[i])
+				return false;
+		}
+		size = half;
+	}
+	return true;
+}
+
+bool VoxelBitmap::IsExterior(const Vector3& p) const
+{
+	Vector3i cell;
+	if (!Locate(p, &cell))
+		return true;
+	const Block* block = FindBlock(cell);
+	if (!block) {
+		if (filled_)
+			return exterior_nodes_.count(FindNode(cell, 0)) > 0;
+		return tree_->IsExterior(p);
+	}
+	int x = cell[0] & 7, bit = (cell[1] & 7) * 8 + (cell[2] & 7);
+	if ((block->occupied[x] >> bit) & 1)
+		return false;
+	return (block->exterior[x] >> bit) & 1;
+}
+
+size_t VoxelBitmap::MemoryBytes() const
+{
+	return blocks_.size() * sizeof(Block)
+		+ block_index_.size() * (sizeof(long long) + sizeof(int)
+		+ 2 * sizeof(void*))
+		+ exterior_nodes_.size() * (sizeof(Octree*) + 2 * sizeof(void*));
+}
@@ -0,0 +1,86 @@
+#ifndef MANIFOLD2_VOXEL_BITMAP_H_
+#define MANIFOLD2_VOXEL_BITMAP_H_
+
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "types.h"
+
+class Octree;
+
+// Occupancy and exterior bits of the finest octree cells, stored sparsely
+// in 8x8x8 blocks (like VDB leaf nodes). Only blocks that contain an
+// occupied cell or one of its 26 neighbors are kept, so neighbor queries
+// around the surface are bit lookups instead of tree walks.
+class VoxelBitmap
+{
+public:
+	VoxelBitmap();
+	// Snapshots tree after its exterior flood fill; tree must stay alive
+	// for IsExterior queries outside the stored blocks.
+	void Build(Octree* tree);
+	// Classifies the exterior itself instead of reading tree's flood fill,
+	// 6-connected from the empty cells on the boundary of the root. Empty
+	// space is filled a whole empty octree node at a time and only surface
+	// blocks voxel by voxel, so time and memory follow the size of the
+	// tree rather than the resolution. Needs none of the octree
+	// connections: neighbors are found by descending from the root, and
+	// tree is only read for occupancy. It must stay alive for queries.
+	void FloodFill(Octree* tree);
+	void Clear();
+	// Upper estimate of what FloodFill keeps for a tree with this many
+	// occupied leaves.
+	static double FloodFillBytes(double leaves);
+
+	int Resolution() const { return resolution_; }
+	// False for cells outside the stored blocks, unless built by FloodFill,
+	// which classifies every cell.
+	bool Occupied(const Vector3i& cell) const;
+	bool Exterior(const Vector3i& cell) const;
+	// Same answer as Octree::IsExterior on the snapshotted tree.
+	bool IsExterior(const Vector3& p) const;
+	size_t MemoryBytes() const;
+
+private:
+	struct Block {
+		uint64_t occupied[8];
+		uint64_t exterior[8];
+	};
+	static long long BlockKey(int x, int y, int z) {
+		return ((long long)x << 40) | ((long long)y << 20) | z;
+	}
+	// pending work of FloodFill
+	struct FillStack;
+	const Block* FindBlock(const Vector3i& cell) const;
+	// The unoccupied node holding cell, or the occupied node of its
+	// surface block; origin receives the first cell of the node.
+	Octree* FindNode(const Vector3i& cell, Vector3i* origin) const;
+	// Marks what is empty in the cells [lo, hi) below node, a cube of size
+	// cells from origin, as exterior: whole empty nodes, and single cells
+	// of surface blocks.
+	void VisitBox(Octree* node, const Vector3i& origin, int size,
+		const Vector3i& lo, const Vector3i& hi, FillStack* stack);
+	void VisitCell(int index, int x, int bit, FillStack* stack);
+	// Finest cell the descent of Octree::IsExterior reaches for p; false
+	// where that descent would leave the box of a cell.
+	bool Locate(const Vector3& p, Vector3i* cell) const;
+	void FillBlock(Octree* node, const Vector3i& origin, int size,
+		const Vector3i& block_origin, Block* block) const;
+
+	Octree* tree_;
+	int depth_;
+	int resolution_;
+	// root is [0,1]^3, as Manifold builds it; enables integer Locate
+	bool unit_root_;
+	std::unordered_map<long long, int> block_index_;
+	std::vector<Block> blocks_;
+	// set by FloodFill, which classifies every cell
+	bool filled_;
+	// FloodFill only: the unoccupied nodes, outside surface blocks, that
+	// are reachable from outside
+	std::unordered_set<const Octree*> exterior_nodes_;
+};
+
+#endif
@@ -0,0 +1,5 @@
+#include "objProcessor.h"
+
+int main(int argc, char** argv) {
+	return process_obj(argc, argv);
+}
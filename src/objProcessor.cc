@@ -1,34 +1,268 @@
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
 #include <igl/readOBJ.h>
 #include <igl/writeOBJ.h>
 
 #include "IO.h"
+#include "Log.h"
 #include "Manifold.h"
+#include "Parallel.h"
 #include "Parser.h"
+#include "Progress.h"
+#include "ResultCache.h"
 #include "types.h"
 
 #include "objProcessor.h" // New header added by Doncey A.
 
+// Empty values leave *value untouched; anything else must be a whole
+// number in [min, max], with nothing after it.
+static bool ReadNumber(Parser& parser, const char* key, long long min,
+	long long max, long long* value)
+{
+	std::string s = parser[key];
+	if (s.empty())
+		return true;
+	char* end = 0;
+	errno = 0;
+	long long number = strtoll(s.c_str(), &end, 10);
+	if (end == s.c_str() || *end != '\0' || errno == ERANGE
+		|| number < min || number > max) {
+		Logf(LOG_ERROR, "Invalid value for --%s: %s (expected a whole number "
+			"from %lld to %lld)", key, s.c_str(), min, max);
+		return false;
+	}
+	*value = number;
+	return true;
+}
+
+static bool ReadNumber(Parser& parser, const char* key, int min, int max,
+	int* value)
+{
+	long long number = *value;
+	if (!ReadNumber(parser, key, (long long)min, (long long)max, &number))
+		return false;
+	*value = (int)number;
+	return true;
+}
+
+static bool ReadNumber(Parser& parser, const char* key, unsigned int* value)
+{
+	long long number = *value;
+	if (!ReadNumber(parser, key, 0LL, (long long)UINT_MAX, &number))
+		return false;
+	*value = (unsigned int)number;
+	return true;
+}
+
+// Same for finite real numbers of at least min.
+static bool ReadNumber(Parser& parser, const char* key, double min,
+	double* value)
+{
+	std::string s = parser[key];
+	if (s.empty())
+		return true;
+	char* end = 0;
+	double number = strtod(s.c_str(), &end);
+	if (end == s.c_str() || *end != '\0' || !std::isfinite(number)
+		|| number < min) {
+		Logf(LOG_ERROR, "Invalid value for --%s: %s (expected a number of at "
+			"least %g)", key, s.c_str(), min);
+		return false;
+	}
+	*value = number;
+	return true;
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
 // Refactored main to be process_obj function
 int process_obj(int argc, char**argv) {
 	Parser parser;
 	parser.AddArgument("input", "../examples/input.obj");
 	parser.AddArgument("output", "../examples/output.obj");
 	parser.AddArgument("depth", "8");
-	parser.ParseArgument(argc, argv);
+	parser.AddArgument("target_error", "");
+	parser.AddArgument("min_depth", "4");
+	parser.AddArgument("time_budget", "");
+	parser.AddArgument("memory_budget", "");
+	parser.AddArgument("memory_policy", "lower");
+	parser.AddArgument("coarse_levels", "0");
+	parser.AddArgument("threads", "0");
+	parser.AddArgument("affinity", "0");
+	parser.AddArgument("first_cpu", "0");
+	parser.AddArgument("format", "");
+	parser.AddArgument("timing", "0");
+	parser.AddArgument("iterations", "0");
+	parser.AddArgument("seed", "0");
+	parser.AddArgument("exterior", "bitmap");
+	parser.AddArgument("deadline", "");
+	parser.AddArgument("log_level", "info");
+	parser.AddArgument("cache", "");
+	parser.AddArgument("cache_size", "1024");
+	if (!parser.ParseArgument(argc, argv)) {
+		parser.Log();
+		return PROCESS_BAD_ARGUMENTS;
+	}
+	const char* levels[] = {"error", "warning", "info", "debug"};
+	int level = 0;
+	while (level < 4 && parser["log_level"] != levels[level])
+		++level;
+	if (level == 4) {
+		Logf(LOG_ERROR, "Unknown log level: %s", parser["log_level"].c_str());
+		return PROCESS_BAD_ARGUMENTS;
+	}
+	SetLogLevel((LogLevel)level);
 	parser.Log();
 
+	int depth = 0, coarse_levels = 0, threads = 0, affinity = 0, timing = 0;
+	int first_cpu = 0;
+	double deadline = 0, cache_size = 0;
+	ProgressiveOptions progressive;
+	ProjectorOptions projector;
+	if (!ReadNumber(parser, "depth", 1, GRID_MAX_DEPTH, &depth)
+		|| !ReadNumber(parser, "coarse_levels", 0, GRID_MAX_DEPTH,
+			&coarse_levels)
+		|| !ReadNumber(parser, "threads", 0, INT_MAX, &threads)
+		|| !ReadNumber(parser, "affinity", 0, 1, &affinity)
+		|| !ReadNumber(parser, "first_cpu", 0, INT_MAX, &first_cpu)
+		|| !ReadNumber(parser, "timing", 0, 1, &timing)
+		|| !ReadNumber(parser, "iterations", 0, INT_MAX,
+			&projector.max_iterations)
+		|| !ReadNumber(parser, "seed", &projector.seed)
+		|| !ReadNumber(parser, "min_depth", 1, GRID_MAX_DEPTH,
+			&progressive.min_depth)
+		|| !ReadNumber(parser, "target_error", 0.0, &progressive.target_error)
+		|| !ReadNumber(parser, "time_budget", 0.0, &progressive.max_seconds)
+		|| !ReadNumber(parser, "deadline", 0.0, &deadline)
+		|| !ReadNumber(parser, "cache_size", 0.0, &cache_size)
+		|| !ReadNumber(parser, "memory_budget", 0.0,
+			&progressive.max_memory_mb))
+		return PROCESS_BAD_ARGUMENTS;
+
+	if (parser["target_error"].size() > 0
+		&& (progressive.min_depth < 1 || progressive.min_depth > depth)) {
+		Logf(LOG_ERROR, "--min_depth must be between 1 and --depth (%d)",
+			depth);
+		return PROCESS_BAD_ARGUMENTS;
+	}
+	if (parser["target_error"].size() > 0 && coarse_levels > 0) {
+		Logf(LOG_ERROR, "--coarse_levels cannot be combined with --target_error");
+		return PROCESS_BAD_ARGUMENTS;
+	}
+
+	// without --format, the output extension decides
+	std::string output = parser["output"];
+	std::string format = parser["format"];
+	if (format.empty()) {
+		format = (output.size() >= 4
+			&& output.compare(output.size() - 4, 4, ".obj") == 0)
+			? "obj" : "off";
+	}
+	if (format != "obj" && format != "off") {
+		Logf(LOG_ERROR, "Unknown output format: %s", format.c_str());
+		return PROCESS_BAD_ARGUMENTS;
+	}
+	std::string exterior = parser["exterior"];
+	if (exterior != "bitmap" && exterior != "connection") {
+		Logf(LOG_ERROR, "Unknown exterior method: %s", exterior.c_str());
+		return PROCESS_BAD_ARGUMENTS;
+	}
+	std::string memory_policy = parser["memory_policy"];
+	if (memory_policy != "lower" && memory_policy != "refuse") {
+		Logf(LOG_ERROR, "Unknown memory policy: %s", memory_policy.c_str());
+		return PROCESS_BAD_ARGUMENTS;
+	}
+	SetNumThreads(threads, affinity != 0, first_cpu);
+
+	auto start = std::chrono::steady_clock::now();
 	MatrixD V, out_V;
 	MatrixI F, out_F;
-	ReadOBJ(parser["input"].c_str(), &V, &F);
+	if (!ReadOBJ(parser["input"].c_str(), &V, &F)) {
+		Logf(LOG_ERROR, "Cannot read %s", parser["input"].c_str());
+		return PROCESS_BAD_INPUT;
+	}
+	double read_seconds = Seconds(start);
 
-	printf("vertex number: %d    face number: %d\n", V.rows(), F.rows());
-	int depth = 0;
-	sscanf(parser["depth"].c_str(), "%d", &depth);
+	Logf(LOG_INFO, "vertex number: %d    face number: %d", (int)V.rows(),
+		(int)F.rows());
+	if (V.rows() == 0 || F.rows() == 0) {
+		Logf(LOG_ERROR, "Empty input mesh");
+		return PROCESS_BAD_INPUT;
+	}
+	if (F.minCoeff() < 0 || F.maxCoeff() >= V.rows()) {
+		Logf(LOG_ERROR, "Face indices out of range");
+		return PROCESS_BAD_INPUT;
+	}
 
+	start = std::chrono::steady_clock::now();
+	// --deadline cancels the job at the first report past it
+	Progress progress;
+	progress.SetCallback([&](const char* stage, double fraction) {
+		if (deadline > 0 && Seconds(start) > deadline)
+			progress.Cancel();
+	});
 	Manifold manifold;
-	manifold.ProcessManifold(V, F, depth, &out_V, &out_F);
+	manifold.SetProgress(&progress);
+	std::unique_ptr<ResultCache> cache;
+	if (!parser["cache"].empty()) {
+		cache.reset(new ResultCache(parser["cache"], cache_size));
+		manifold.SetCache(cache.get());
+	}
+	manifold.SetProjectorOptions(projector);
+	manifold.SetExteriorMethod(exterior == "bitmap"
+		? EXTERIOR_BITMAP : EXTERIOR_CONNECTION);
+	// the budget lowers the (first) depth or refuses the job
+	manifold.SetMemoryBudget(progressive.max_memory_mb,
+		memory_policy == "lower");
+	if (parser["target_error"].size() > 0) {
+		// progressive mode: --depth is the deepest level to try
+		progressive.max_depth = depth;
+		depth = manifold.ProcessManifoldProgressive(V, F, progressive,
+			&out_V, &out_F);
+		if (depth >= 0)
+			Logf(LOG_INFO, "final depth: %d", depth);
+	} else {
+		if (coarse_levels > 0) {
+			depth = manifold.ProcessManifoldMultiResolution(V, F, depth,
+				coarse_levels, &out_V, &out_F);
+		} else {
+			depth = manifold.ProcessManifold(V, F, depth, &out_V, &out_F);
+		}
+	}
+	if (manifold.Status() == MANIFOLD_OVER_BUDGET)
+		return PROCESS_OVER_BUDGET;
+	if (manifold.Status() == MANIFOLD_CANCELLED)
+		return PROCESS_CANCELLED;
+	if (manifold.Status() == MANIFOLD_FAILED)
+		return PROCESS_FAILED;
+	double process_seconds = Seconds(start);
 
-	WriteOFF(parser["output"].c_str(), out_V, out_F);
+	start = std::chrono::steady_clock::now();
+	bool written = (format == "obj")
+		? WriteOBJ(output.c_str(), out_V, out_F)
+		: WriteOFF(output.c_str(), out_V, out_F);
+	if (!written) {
+		Logf(LOG_ERROR, "Cannot write %s", output.c_str());
+		return PROCESS_WRITE_FAILED;
+	}
+	double write_seconds = Seconds(start);
 
-	return 0;
-}
\ No newline at end of file
+	// asked for explicitly, so --log_level does not filter it
+	if (timing) {
+		printf("Timing: read %lf, process %lf, write %lf seconds\n",
+			read_seconds, process_seconds, write_seconds);
+		fflush(stdout);
+	}
+	return PROCESS_OK;
+}
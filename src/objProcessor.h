@@ -1,6 +1,17 @@
 #ifndef OBJ_PROCESSOR_H
 #define OBJ_PROCESSOR_H
 
+// Return values of process_obj, used as the exit status of ManifoldPlus.
+enum ProcessStatus {
+	PROCESS_OK = 0,
+	PROCESS_BAD_ARGUMENTS = 1,
+	PROCESS_BAD_INPUT = 2,
+	PROCESS_WRITE_FAILED = 3,
+	PROCESS_OVER_BUDGET = 4,
+	PROCESS_CANCELLED = 5,
+	PROCESS_FAILED = 6
+};
+
 int process_obj(int argc, char **argv);
 
 #endif // OBJ_PROCESSOR_H
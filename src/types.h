@@ -17,4 +17,9 @@ typedef Eigen::Matrix<FT,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> MatrixD;
 typedef Eigen::Matrix<int,Eigen::Dynamic,Eigen::Dynamic
 	,Eigen::RowMajor> MatrixI;
 
+// Read-only views that bind to MatrixD/MatrixI or to external row-major
+// buffers (e.g. NumPy arrays) without a copy.
+typedef Eigen::Ref<const MatrixD> MatrixDRef;
+typedef Eigen::Ref<const MatrixI> MatrixIRef;
+
 #endif
\ No newline at end of file
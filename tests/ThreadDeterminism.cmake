@@ -0,0 +1,30 @@
+# Runs MANIFOLD on INPUT with 1, 2, 8 and 32 threads and fails unless every
+# run writes the same bytes. ARGS holds the other options, separated by
+# spaces; outputs go to WORK_DIR.
+#
+#   cmake -DMANIFOLD=... -DINPUT=... -DWORK_DIR=... "-DARGS=--depth 6"
+#         -P ThreadDeterminism.cmake
+
+separate_arguments(ARGS UNIX_COMMAND "${ARGS}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+
+set(expected "")
+foreach(threads 1 2 8 32)
+    set(output "${WORK_DIR}/output_${threads}.obj")
+    file(REMOVE "${output}")
+    execute_process(
+        COMMAND "${MANIFOLD}" --input "${INPUT}" --output "${output}"
+            --threads ${threads} --log_level error ${ARGS}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "--threads ${threads} exited with ${result}")
+    endif()
+    file(SHA256 "${output}" hash)
+    message(STATUS "--threads ${threads}: ${hash}")
+    if(expected STREQUAL "")
+        set(expected "${hash}")
+    elseif(NOT hash STREQUAL expected)
+        message(FATAL_ERROR "--threads ${threads} differs from --threads 1")
+    endif()
+endforeach()